@@ -0,0 +1,76 @@
+#include "symcalc/symcalc.hpp"
+#include <cstdlib>
+#include <new>
+
+using namespace symcalc;
+
+// Explanation:
+// Evaluating on a latency-sensitive path shouldn't touch the heap
+// This program replaces the global operator new and delete to count allocations, prepares an expression
+// that uses every kind of node, then checks that evaluating it allocates nothing:
+// - Equation::eval() with a map of variable names, which only reads the map
+// - CompiledEquation::eval() with a workspace, which only writes to the workspace
+//
+
+
+size_t allocations = 0;
+
+void* operator new(size_t size){
+	allocations++;
+	void* pointer = std::malloc(size == 0 ? 1 : size);
+	if(pointer == nullptr){
+		throw std::bad_alloc();
+	}
+	return pointer;
+}
+
+void* operator new[](size_t size){
+	return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept{
+	std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept{
+	std::free(pointer);
+}
+
+// Sized forms, used by C++14 and later, so every delete pairs with the new above
+void operator delete(void* pointer, size_t) noexcept{
+	std::free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept{
+	std::free(pointer);
+}
+
+
+int main(){
+	Equation x ("x");
+	Equation y ("y");
+	
+	// Sums, negations, products, divisions, powers, logarithms, exponents, absolute values, sines, cosines, variables, values and constants
+	Equation fxy = sin(x) * cos(y) + exp(x / y) - ln(abs(x) + 1) + log(y, 2) + x.pow(y) + x.pow(3) - 5 * x.pow(2) + Constants::Pi * y;
+	
+	std::cout << "f(x, y) = " << fxy << std::endl;
+	
+	// Preparation is allowed to allocate
+	SYMCALC_VAR_HASH_TYPE values = {{"x", 1.5}, {"y", 2.5}};
+	CompiledEquation compiled = fxy.compile({x, y});
+	std::vector<double> inputs = {1.5, 2.5};
+	std::vector<double> workspace (compiled.workspace_size());
+	
+	size_t before = allocations;
+	double tree_value = fxy.eval(values);
+	size_t tree_allocations = allocations - before;
+	
+	before = allocations;
+	double compiled_value = compiled.eval(inputs.data(), workspace.data());
+	size_t compiled_allocations = allocations - before;
+	
+	std::cout << "f(1.5, 2.5) = " << tree_value << ", allocations: " << tree_allocations << std::endl;
+	std::cout << "Compiled f(1.5, 2.5) = " << compiled_value << ", allocations: " << compiled_allocations << std::endl;
+	
+	return tree_allocations == 0 && compiled_allocations == 0 ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+#include "symcalc/symcalc.hpp"
+
+using namespace symcalc;
+
+// Explanation:
+// Besides derivative(), SymCalc can compute derivatives without building derivative trees:
+// reverse mode for gradients, forward mode for directional derivatives, Taylor mode for higher orders,
+// sparse Hessians and Hessian-vector products on compiled programs, and lazy derivative views
+//
+// Here every one of them is checked against the symbolic derivatives at a point,
+// the program fails if any of them doesn't match
+
+const double TOLERANCE = 1e-9;
+
+int mismatches = 0;
+
+void check(const std::string& name, double value, double expected){
+	if(std::abs(value - expected) > TOLERANCE * (1 + std::abs(expected))){
+		std::cout << name << " = " << value << ", expected " << expected << std::endl;
+		mismatches++;
+	}
+}
+
+
+int main(){
+	Equation x ("x");
+	Equation y ("y");
+	Equation z ("z");
+	Equation w ("w");
+	std::vector<Equation> variables {x, y, z, w};
+
+	// x and w never appear together, so their entry of the Hessian is zero
+	Equation f = x * y + sin(y * z) + exp(z) * w.pow(2) + ln(x * x + 1);
+
+	std::vector<double> point {0.5, -1.2, 0.8, 2};
+	SYMCALC_VAR_HASH_TYPE values {{"x", 0.5}, {"y", -1.2}, {"z", 0.8}, {"w", 2}};
+	std::vector<double> direction {1, -0.5, 2, 0.25};
+
+	// Symbolic gradient and Hessian, the reference for everything below
+	size_t n = variables.size();
+	std::vector<double> gradient (n);
+	std::vector<std::vector<double>> hessian (n, std::vector<double>(n));
+	for(size_t i = 0; i < n; i++){
+		Equation partial = f.derivative(variables[i]);
+		gradient[i] = partial.eval(values);
+		for(size_t j = 0; j < n; j++){
+			hessian[i][j] = partial.derivative(variables[j]).eval(values);
+		}
+	}
+
+	std::cout << "f(x, y, z, w) = " << f << std::endl;
+
+
+	// Reverse mode on the compiled program
+	CompiledEquation program (f, variables);
+	std::vector<double> reverse_gradient;
+	check("value_and_gradient() value", program.value_and_gradient(point, reverse_gradient), f.eval(values));
+	for(size_t i = 0; i < n; i++){
+		check("value_and_gradient() partial " + std::to_string(i), reverse_gradient[i], gradient[i]);
+	}
+
+	// Gradient built as one graph
+	std::vector<Equation> partials = f.gradient(variables);
+	for(size_t i = 0; i < n; i++){
+		check("gradient() partial " + std::to_string(i), partials[i].eval(values), gradient[i]);
+	}
+
+	// Forward mode, the directional derivative is the gradient times the direction
+	double directional = 0;
+	for(size_t i = 0; i < n; i++){
+		directional += gradient[i] * direction[i];
+	}
+	check("jacobian_vector_product()", program.jacobian_vector_product(point, direction)[0], directional);
+
+	SYMCALC_VAR_HASH_TYPE direction_hash {{"x", direction[0]}, {"y", direction[1]}, {"z", direction[2]}, {"w", direction[3]}};
+	check("eval_dual()", f.eval_dual(values, {direction_hash}).tangents[0], directional);
+
+	// Sparse Hessian, every entry of the pattern and every nonzero outside of it
+	SparseHessian sparse (f, variables);
+	std::vector<double> sparse_values = sparse.eval(point);
+	std::vector<std::vector<bool>> in_pattern (n, std::vector<bool>(n, false));
+	for(size_t k = 0; k < sparse.nonzeros(); k++){
+		in_pattern[sparse.rows[k]][sparse.columns[k]] = true;
+		check("SparseHessian entry " + std::to_string(sparse.rows[k]) + ", " + std::to_string(sparse.columns[k]), sparse_values[k], hessian[sparse.rows[k]][sparse.columns[k]]);
+	}
+	for(size_t i = 0; i < n; i++){
+		for(size_t j = 0; j < n; j++){
+			if(!in_pattern[i][j]){
+				check("SparseHessian missing entry " + std::to_string(i) + ", " + std::to_string(j), 0, hessian[i][j]);
+			}
+		}
+	}
+
+	// Hessian-vector product
+	std::vector<double> product = program.hessian_vector_product(point, direction);
+	for(size_t i = 0; i < n; i++){
+		double expected = 0;
+		for(size_t j = 0; j < n; j++){
+			expected += hessian[i][j] * direction[j];
+		}
+		check("hessian_vector_product() row " + std::to_string(i), product[i], expected);
+	}
+
+	// Taylor mode, derivatives of every order in z
+	std::vector<double> taylor = f.derivatives_at(z, 0.8, 4, values);
+	for(size_t k = 0; k <= 4; k++){
+		Equation symbolic = k == 0 ? f : f.derivative(z, k);
+		check("derivatives_at() order " + std::to_string(k), taylor[k], symbolic.eval(values));
+	}
+
+	// Lazy views, on one variable and on two
+	check("lazy_derivative() order 3", f.lazy_derivative(y, 3).eval(values), f.derivative(y, 3).eval(values));
+	check("mixed lazy_derivative()", f.lazy_derivative(z).lazy_derivative(w).eval(values), hessian[2][3]);
+
+
+	std::cout << "Hessian colors: " << sparse.colors_count << " for " << n << " variables, nonzeros: " << sparse.nonzeros() << std::endl;
+	std::cout << "Mismatches: " << mismatches << std::endl;
+
+	return mismatches == 0 ? 0 : 1;
+}
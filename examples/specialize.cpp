@@ -0,0 +1,36 @@
+#include "symcalc/symcalc.hpp"
+
+using namespace symcalc;
+
+// Explanation:
+// specialize() replaces some variables with values and folds everything that becomes constant
+// Numbers left next to variables in a sum or a product are folded too, so a model with known parameters
+// keeps one offset and one coefficient instead of every parameter it was written with
+//
+// Let's specialize a model in x and y with parameters a, b and c
+
+int main(){
+	Equation x ("x");
+	Equation y ("y");
+	Equation a ("a");
+	Equation b ("b");
+	Equation c ("c");
+
+	// Declare the model
+	Equation model = a + b + x * a * b + sin(c * y) + c;
+
+	std::cout << "model = " << model << std::endl;
+
+	// Give values to the parameters, only x and y are left
+	Equation specialized = model.specialize({{a, 1.5}, {b, 2}, {c, 0.5}});
+
+	std::cout << "with a = 1.5, b = 2, c = 0.5: " << specialized << std::endl;
+
+	// Both give the same values
+	double full_value = model.eval({{x, 3}, {y, 4}, {a, 1.5}, {b, 2}, {c, 0.5}});
+	double specialized_value = specialized.eval({{x, 3}, {y, 4}});
+
+	std::cout << "at x = 3, y = 4: " << full_value << " and " << specialized_value << std::endl;
+
+	return std::abs(full_value - specialized_value) < 1e-12 ? 0 : 1;
+}
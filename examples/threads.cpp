@@ -0,0 +1,105 @@
+#include "symcalc/symcalc.hpp"
+#include <sstream>
+#include <thread>
+
+using namespace symcalc;
+
+// Explanation:
+// Expressions can be built, differentiated and simplified on several threads at once
+// Every thread has its own Context with its settings, so one thread can turn off automatic simplification
+// without changing anything for the others
+//
+// Here every thread builds the same function and its derivative, half of them with automatic simplification
+// and half without, then checks that the values match the ones computed on the main thread
+// Each thread also writes x + 0, which only turns into x where automatic simplification is on,
+// and the last threads keep simplifications and derivatives in caches of their own instead of the shared ones
+//
+
+const int THREADS = 8;
+const int ROUNDS = 50;
+
+
+Equation build_function(){
+	Equation x ("x");
+	Equation y ("y");
+	return sin(x * y) + exp(x) * y.pow(3) + ln(x * x + 1) * Constants::Pi;
+}
+
+
+int main(){
+	Equation x ("x");
+	Equation y ("y");
+	
+	// Values computed on the main thread
+	Equation fxy = build_function();
+	double expected_value = fxy.eval({{x, 0.5}, {y, 2}});
+	double expected_derivative = fxy.derivative(x).eval({{x, 0.5}, {y, 2}});
+	
+	std::vector<int> mismatches (THREADS, 0);
+	std::vector<std::string> written (THREADS);
+	std::vector<size_t> cached (THREADS, 0);
+	std::vector<std::thread> threads;
+	
+	for(int t = 0; t < THREADS; t++){
+		threads.push_back(std::thread([t, &mismatches, &written, &cached, expected_value, expected_derivative](){
+			// Odd threads build expressions as they are written
+			Context context;
+			context.auto_simplify = t % 2 == 0;
+			
+			// The caches have to outlive the scope that uses them
+			EquationCache simplifications;
+			EquationCache derivatives;
+			if(t >= THREADS / 2){
+				context.simplify_cache = &simplifications;
+				context.derivative_cache = &derivatives;
+			}
+			ContextScope scope (context);
+			
+			Equation x ("x");
+			Equation y ("y");
+			
+			std::ostringstream text;
+			text << x + 0.0;
+			written[t] = text.str();
+			if(written[t] != (t % 2 == 0 ? "x" : "(x) + (0)")){
+				mismatches[t]++;
+			}
+			
+			for(int i = 0; i < ROUNDS; i++){
+				Equation fxy = build_function();
+				Equation dfdx = fxy.derivative(x).simplify();
+				
+				double value = fxy.eval({{x, 0.5}, {y, 2}});
+				double derivative = dfdx.eval({{x, 0.5}, {y, 2}});
+				
+				if(std::abs(value - expected_value) > 1e-12 || std::abs(derivative - expected_derivative) > 1e-12){
+					mismatches[t]++;
+				}
+			}
+			
+			cached[t] = simplifications.size() + derivatives.size();
+			if(t >= THREADS / 2 && cached[t] == 0){
+				mismatches[t]++;
+			}
+		}));
+	}
+	
+	for(std::thread& thread : threads){
+		thread.join();
+	}
+	
+	int total_mismatches = 0;
+	for(int count : mismatches){
+		total_mismatches += count;
+	}
+	
+	for(int t = 0; t < THREADS; t++){
+		std::cout << "Thread " << t << ": x + 0 = " << written[t] << (t >= THREADS / 2 ? ", private caches" : ", shared caches") << std::endl;
+	}
+	
+	std::cout << "f(0.5, 2) = " << expected_value << std::endl;
+	std::cout << "df/dx(0.5, 2) = " << expected_derivative << std::endl;
+	std::cout << THREADS << " threads built the function " << ROUNDS << " times each, mismatches: " << total_mismatches << std::endl;
+	
+	return total_mismatches == 0 ? 0 : 1;
+}
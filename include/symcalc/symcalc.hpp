@@ -22,6 +22,19 @@
 #include <vector>
 #include <cmath>
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <future>
+#include <functional>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <stdexcept>
+
 
 namespace symcalc{
 
@@ -29,9 +42,6 @@ typedef double SYMCALC_VALUE_TYPE;
 typedef std::string SYMCALC_VAR_NAME_TYPE;
 typedef std::map<SYMCALC_VAR_NAME_TYPE, SYMCALC_VALUE_TYPE> SYMCALC_VAR_HASH_TYPE;
 
-extern bool SYMCALC_AUTO_SIMPLIFY;
-
-
 // Include helper function used to find if an element is in a vector, defined here since it's a template function
 template<typename T> bool include(std::vector<T> vec, T element){
 	for(T el : vec){
@@ -43,25 +53,74 @@ template<typename T> bool include(std::vector<T> vec, T element){
 }
 
 
+// Value with its derivatives along several directions, used for forward-mode evaluation, defined in dual.cpp
+struct Dual{
+	SYMCALC_VALUE_TYPE value;
+	std::vector<SYMCALC_VALUE_TYPE> tangents; // One derivative per direction
+	
+	Dual();
+	Dual(SYMCALC_VALUE_TYPE value, std::vector<SYMCALC_VALUE_TYPE> tangents);
+	
+	// Value with zero tangents
+	static Dual constant(SYMCALC_VALUE_TYPE value, size_t lanes);
+};
+
+typedef std::map<SYMCALC_VAR_NAME_TYPE, Dual> SYMCALC_DUAL_HASH_TYPE;
+
+
+// Truncated Taylor series in one variable around a point, coefficients from the lowest power, defined in taylor.cpp
+// The coefficient of power k is the kth derivative divided by k!
+typedef std::vector<SYMCALC_VALUE_TYPE> TaylorSeries;
+
+
 // Inside classes, defined in symcalc.cpp
 
 class EquationBase{
 public:
 	std::string type;
 	
+	// Structural hash of the node, computed once the node is constructed
+	size_t hash_value;
+	
+	// Number of owners of the node, nodes are immutable after construction so they are shared instead of deep-copied
+	mutable std::atomic<size_t> references;
+	
+	// Sorted names of the variables the node depends on, nodes with the same set share it
+	std::shared_ptr<const std::vector<SYMCALC_VAR_NAME_TYPE>> dependencies;
+	
+	// Number of nodes in the tree, shared subtrees are counted every time they appear
+	size_t tree_size;
+	
 	
 	EquationBase(std::string el_type);
 	EquationBase(const EquationBase& lvalue);
 	~EquationBase();
 	
 	virtual std::string txt() const {return "";};
-	virtual SYMCALC_VALUE_TYPE eval(SYMCALC_VAR_HASH_TYPE var_hash) const {return 0.0;};
+	// Only reads the map, so evaluating a tree doesn't allocate, lazy derivatives are the exception since they evaluate in forward mode
+	virtual SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const {return 0.0;};
+	// Forward-mode evaluation, follows the same rules as _derivative()
+	virtual Dual eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const;
+	// Taylor-mode evaluation, the series of the node up to the given order in one variable, other variables are fixed
+	virtual TaylorSeries eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const;
 	virtual EquationBase* _derivative(SYMCALC_VAR_NAME_TYPE var) const {return nullptr;};
 	
 	virtual std::vector<SYMCALC_VAR_NAME_TYPE> list_variables() const{return std::vector<SYMCALC_VAR_NAME_TYPE>();};
+	bool depends_on(const SYMCALC_VAR_NAME_TYPE& var) const;
 	
 	virtual EquationBase* _simplify() const;
 	
+	// Generic access to the child nodes, in the order they appear in the node
+	virtual size_t _children_count() const {return 0;};
+	virtual EquationBase* _child(size_t i) const {return nullptr;};
+	// Creates a node of the same type with the given children, takes ownership of the children
+	virtual EquationBase* _rebuild(std::vector<EquationBase*> children) const;
+	
+	// Structural comparison with a node of the same type and hash, children are compared with equal()
+	virtual bool _equals(const EquationBase* other) const;
+	// Computes hash_value and dependencies from the children, called at the end of every constructor
+	virtual void _cache_structure();
+	
 	virtual EquationBase* _copy_equation_base() const = 0;
 	virtual void _delete_equation_base() = 0;
 };
@@ -79,13 +138,18 @@ public:
 	~Variable();
 	
 	std::string txt() const override;
-	SYMCALC_VALUE_TYPE eval(SYMCALC_VAR_HASH_TYPE var_hash) const override;
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const override;
+	Dual eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const override;
+	TaylorSeries eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const override;
 	EquationBase* _derivative(SYMCALC_VAR_NAME_TYPE var) const override;
 	
 	std::vector<SYMCALC_VAR_NAME_TYPE> list_variables() const override;
 	
 	EquationBase* _simplify() const override;
 	
+	bool _equals(const EquationBase* other) const override;
+	void _cache_structure() override;
+	
 	EquationBase* _copy_equation_base() const override;
 	void _delete_equation_base() override;
 };
@@ -103,13 +167,18 @@ public:
 	~EquationValue();
 	
 	std::string txt() const override;
-	SYMCALC_VALUE_TYPE eval(SYMCALC_VAR_HASH_TYPE var_hash) const override;
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const override;
+	Dual eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const override;
+	TaylorSeries eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const override;
 	EquationBase* _derivative(SYMCALC_VAR_NAME_TYPE var) const override;
 	
 	std::vector<SYMCALC_VAR_NAME_TYPE> list_variables() const override;
 	
 	EquationBase* _simplify() const override;
 	
+	bool _equals(const EquationBase* other) const override;
+	void _cache_structure() override;
+	
 	EquationBase* _copy_equation_base() const override;
 	void _delete_equation_base() override;
 };
@@ -124,6 +193,9 @@ public:
 	
 	std::string txt() const override;
 	
+	bool _equals(const EquationBase* other) const override;
+	void _cache_structure() override;
+	
 	EquationBase* _copy_equation_base() const override;
 	void _delete_equation_base() override;
 };
@@ -135,7 +207,6 @@ EquationBase* to_equation(SYMCALC_VALUE_TYPE num);
 class Sum : public EquationBase{
 public:
 	std::vector<EquationBase*> elements;
-	std::string ready_txt;
 	
 	Sum(std::vector<EquationBase*> elements);
 	Sum(const Sum& lvalue);
@@ -143,13 +214,19 @@ public:
 	~Sum();
 
 	std::string txt() const override;
-	SYMCALC_VALUE_TYPE eval(SYMCALC_VAR_HASH_TYPE var_hash) const override;
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const override;
+	Dual eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const override;
+	TaylorSeries eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const override;
 	EquationBase* _derivative(SYMCALC_VAR_NAME_TYPE var) const override;
 	
 	std::vector<SYMCALC_VAR_NAME_TYPE> list_variables() const override;
 	
 	EquationBase* _simplify() const override;
 	
+	size_t _children_count() const override;
+	EquationBase* _child(size_t i) const override;
+	EquationBase* _rebuild(std::vector<EquationBase*> children) const override;
+	
 	EquationBase* _copy_equation_base() const override;
 	void _delete_equation_base() override;
 };
@@ -158,7 +235,6 @@ public:
 class Negate : public EquationBase{
 public:
 	EquationBase* eq;
-	std::string ready_txt;
 	
 	Negate(EquationBase* eq);
 	Negate(const Negate& lvalue);
@@ -166,13 +242,19 @@ public:
 	~Negate();
 
 	std::string txt() const override;
-	SYMCALC_VALUE_TYPE eval(SYMCALC_VAR_HASH_TYPE var_hash) const override;
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const override;
+	Dual eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const override;
+	TaylorSeries eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const override;
 	EquationBase* _derivative(SYMCALC_VAR_NAME_TYPE var) const override;
 	
 	std::vector<SYMCALC_VAR_NAME_TYPE> list_variables() const override;
 	
 	EquationBase* _simplify() const override;
 	
+	size_t _children_count() const override;
+	EquationBase* _child(size_t i) const override;
+	EquationBase* _rebuild(std::vector<EquationBase*> children) const override;
+	
 	EquationBase* _copy_equation_base() const override;
 	void _delete_equation_base() override;
 };
@@ -182,21 +264,37 @@ public:
 class Mult : public EquationBase{
 public:
 	std::vector<EquationBase*> elements;
-	std::string ready_txt;
 	
-	Mult(std::vector<EquationBase*> elements);
+	// Nested products are kept as shared subexpressions instead of being flattened into this one
+	bool grouped;
+	
+	// Products with more factors than this are differentiated through a balanced grouping of the factors
+	static const size_t SHARED_PRODUCT_RULE_SIZE = 3;
+	
+	Mult(std::vector<EquationBase*> elements, bool flatten = true);
 	Mult(const Mult& lvalue);
 
 	~Mult();
 
 	std::string txt() const override;
-	SYMCALC_VALUE_TYPE eval(SYMCALC_VAR_HASH_TYPE var_hash) const override;
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const override;
+	Dual eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const override;
+	TaylorSeries eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const override;
 	EquationBase* _derivative(SYMCALC_VAR_NAME_TYPE var) const override;
+	EquationBase* _shared_derivative(SYMCALC_VAR_NAME_TYPE var) const;
 	
 	std::vector<SYMCALC_VAR_NAME_TYPE> list_variables() const override;
 	
 	EquationBase* _simplify() const override;
 	
+	size_t _children_count() const override;
+	EquationBase* _child(size_t i) const override;
+	EquationBase* _rebuild(std::vector<EquationBase*> children) const override;
+	
+	// Grouped and flat products are different nodes, so they aren't merged by the caches
+	bool _equals(const EquationBase* other) const override;
+	void _cache_structure() override;
+	
 	EquationBase* _copy_equation_base() const override;
 	void _delete_equation_base() override;
 };
@@ -207,7 +305,6 @@ class Div : public EquationBase{
 public:
 	EquationBase* dividend;
 	EquationBase* divisor;
-	std::string ready_txt;
 	
 	Div(EquationBase* dividend, EquationBase* divisor);
 	Div(const Div& lvalue);
@@ -215,13 +312,19 @@ public:
 	~Div();
 
 	std::string txt() const override;
-	SYMCALC_VALUE_TYPE eval(SYMCALC_VAR_HASH_TYPE var_hash) const override;
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const override;
+	Dual eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const override;
+	TaylorSeries eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const override;
 	EquationBase* _derivative(SYMCALC_VAR_NAME_TYPE var) const override;
 
 	std::vector<SYMCALC_VAR_NAME_TYPE> list_variables() const override;
 	
 	EquationBase* _simplify() const override;
 	
+	size_t _children_count() const override;
+	EquationBase* _child(size_t i) const override;
+	EquationBase* _rebuild(std::vector<EquationBase*> children) const override;
+	
 	EquationBase* _copy_equation_base() const override;
 	void _delete_equation_base() override;
 };
@@ -234,7 +337,6 @@ public:
 	
 	EquationBase* base;
 	EquationBase* power;
-	std::string ready_txt;
 	
 	Power(EquationBase* base, EquationBase* power);
 	Power(const Power& lvalue);
@@ -242,13 +344,19 @@ public:
 	~Power();
 
 	std::string txt() const override;
-	SYMCALC_VALUE_TYPE eval(SYMCALC_VAR_HASH_TYPE var_hash) const override;
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const override;
+	Dual eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const override;
+	TaylorSeries eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const override;
 	EquationBase* _derivative(SYMCALC_VAR_NAME_TYPE var) const override;
 	
 	std::vector<SYMCALC_VAR_NAME_TYPE> list_variables() const override;
 	
 	EquationBase* _simplify() const override;
 	
+	size_t _children_count() const override;
+	EquationBase* _child(size_t i) const override;
+	EquationBase* _rebuild(std::vector<EquationBase*> children) const override;
+	
 	EquationBase* _copy_equation_base() const override;
 	void _delete_equation_base() override;
 };
@@ -258,7 +366,6 @@ class Log : public EquationBase{
 public:
 	EquationBase* base;
 	EquationBase* eq;
-	std::string ready_txt;
 	
 	Log(EquationBase* eq, EquationBase* base);
 	Log(const Log& lvalue);
@@ -266,13 +373,19 @@ public:
 	~Log();
 	
 	std::string txt() const override;
-	SYMCALC_VALUE_TYPE eval(SYMCALC_VAR_HASH_TYPE var_hash) const override;
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const override;
+	Dual eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const override;
+	TaylorSeries eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const override;
 	EquationBase* _derivative(SYMCALC_VAR_NAME_TYPE var) const override;
 	
 	std::vector<SYMCALC_VAR_NAME_TYPE> list_variables() const override;
 	
 	EquationBase* _simplify() const override;
 	
+	size_t _children_count() const override;
+	EquationBase* _child(size_t i) const override;
+	EquationBase* _rebuild(std::vector<EquationBase*> children) const override;
+	
 	EquationBase* _copy_equation_base() const override;
 	void _delete_equation_base() override;
 };
@@ -282,7 +395,6 @@ class Ln : public EquationBase{
 public:
 
 	EquationBase* eq;
-	std::string ready_txt;
 	
 	Ln(EquationBase* eq);
 	Ln(const Ln& lvalue);
@@ -290,13 +402,19 @@ public:
 	~Ln();
 
 	std::string txt() const override;
-	SYMCALC_VALUE_TYPE eval(SYMCALC_VAR_HASH_TYPE var_hash) const override;
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const override;
+	Dual eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const override;
+	TaylorSeries eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const override;
 	EquationBase* _derivative(SYMCALC_VAR_NAME_TYPE var) const override;
 	
 	std::vector<SYMCALC_VAR_NAME_TYPE> list_variables() const override;
 	
 	EquationBase* _simplify() const override;
 	
+	size_t _children_count() const override;
+	EquationBase* _child(size_t i) const override;
+	EquationBase* _rebuild(std::vector<EquationBase*> children) const override;
+	
 	EquationBase* _copy_equation_base() const override;
 	void _delete_equation_base() override;
 };
@@ -316,13 +434,19 @@ public:
 	
 	std::string txt() const override;
 	
-	SYMCALC_VALUE_TYPE eval(SYMCALC_VAR_HASH_TYPE var_hash) const override;
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const override;
+	Dual eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const override;
+	TaylorSeries eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const override;
 	EquationBase* _derivative(SYMCALC_VAR_NAME_TYPE var) const override;
 	
 	std::vector<SYMCALC_VAR_NAME_TYPE> list_variables() const override;
 	
 	EquationBase* _simplify() const override;
 	
+	size_t _children_count() const override;
+	EquationBase* _child(size_t i) const override;
+	EquationBase* _rebuild(std::vector<EquationBase*> children) const override;
+	
 	EquationBase* _copy_equation_base() const override;
 	void _delete_equation_base() override;
 };
@@ -345,13 +469,19 @@ public:
 	
 	std::string txt() const override;
 	
-	SYMCALC_VALUE_TYPE eval(SYMCALC_VAR_HASH_TYPE var_hash) const override;
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const override;
+	Dual eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const override;
+	TaylorSeries eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const override;
 	
 	std::vector<SYMCALC_VAR_NAME_TYPE> list_variables() const override;
 
 	EquationBase* _derivative(SYMCALC_VAR_NAME_TYPE var) const override;
 	
 	EquationBase* _simplify() const override;
+	
+	size_t _children_count() const override;
+	EquationBase* _child(size_t i) const override;
+	EquationBase* _rebuild(std::vector<EquationBase*> children) const override;
 };
 
 
@@ -375,13 +505,19 @@ public:
 	
 	std::string txt() const override;
 	
-	SYMCALC_VALUE_TYPE eval(SYMCALC_VAR_HASH_TYPE var_hash) const override;
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const override;
+	Dual eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const override;
+	TaylorSeries eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const override;
 	
 	std::vector<SYMCALC_VAR_NAME_TYPE> list_variables() const override;
 
 	EquationBase* _derivative(SYMCALC_VAR_NAME_TYPE var) const override;
 	
 	EquationBase* _simplify() const override;
+	
+	size_t _children_count() const override;
+	EquationBase* _child(size_t i) const override;
+	EquationBase* _rebuild(std::vector<EquationBase*> children) const override;
 };
 
 
@@ -403,13 +539,65 @@ public:
 	
 	std::string txt() const override;
 	
-	SYMCALC_VALUE_TYPE eval(SYMCALC_VAR_HASH_TYPE var_hash) const override;
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const override;
+	Dual eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const override;
+	TaylorSeries eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const override;
 	
 	std::vector<SYMCALC_VAR_NAME_TYPE> list_variables() const override;
 
 	EquationBase* _derivative(SYMCALC_VAR_NAME_TYPE var) const override;
 	
 	EquationBase* _simplify() const override;
+	
+	size_t _children_count() const override;
+	EquationBase* _child(size_t i) const override;
+	EquationBase* _rebuild(std::vector<EquationBase*> children) const override;
+};
+
+
+
+// Derivative that is only built when it's needed, defined in lazy.cpp
+// eval() runs forward mode on the expression, or Taylor mode for stacked views on the same variable, like a second derivative
+// Views on different variables, like d/dy of d/dx, evaluate the inner view through its expansion
+// Everything else goes through the expansion, its only child,
+// which applies the rule of the top node and leaves the derivatives of the children lazy
+// so a derivative is built one subtree at a time, and only where it is inspected, simplified or compiled
+class LazyDerivative : public EquationBase{
+public:
+	EquationBase* eq;
+	SYMCALC_VAR_NAME_TYPE var;
+	mutable std::atomic<EquationBase*> expansion; // Built on first use
+	
+	LazyDerivative(EquationBase* eq, SYMCALC_VAR_NAME_TYPE var);
+	LazyDerivative(const LazyDerivative& lvalue);
+	
+	~LazyDerivative();
+	
+	EquationBase* _copy_equation_base() const override;
+	void _delete_equation_base() override;
+	
+	std::string txt() const override;
+	
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const override;
+	Dual eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const override;
+	TaylorSeries eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const override;
+	
+	std::vector<SYMCALC_VAR_NAME_TYPE> list_variables() const override;
+	
+	EquationBase* _derivative(SYMCALC_VAR_NAME_TYPE var) const override;
+	
+	EquationBase* _simplify() const override;
+	
+	EquationBase* _expanded() const;
+	
+	size_t _children_count() const override;
+	EquationBase* _child(size_t i) const override;
+	// The view is replaced by its rebuilt expansion
+	EquationBase* _rebuild(std::vector<EquationBase*> children) const override;
+	
+	// Compared and hashed by the expression and the variable, so the expansion isn't built for it
+	bool _equals(const EquationBase* other) const override;
+	void _cache_structure() override;
 };
 
 
@@ -420,6 +608,133 @@ EquationBase* copy(const EquationBase* start_eq);
 std::vector<EquationBase*> copy(std::vector<const EquationBase*> start_eq);
 void delete_equation_base(EquationBase* eq);
 
+// Structural hashing and comparison of EquationBase trees, defined in helpers.cpp
+size_t hash_combine(size_t seed, size_t value);
+bool equal(const EquationBase* eq1, const EquationBase* eq2);
+
+// Simplifies a node through the simplification cache, used instead of calling _simplify() on child nodes, defined in helpers.cpp
+EquationBase* simplify_equation_base(const EquationBase* eq);
+
+// Differentiates a node through the derivative cache, returning zero right away if it doesn't depend on the variable,
+// used instead of calling _derivative() on child nodes, defined in helpers.cpp
+EquationBase* derivative_equation_base(const EquationBase* eq, const SYMCALC_VAR_NAME_TYPE& var);
+// Applies the rule of the top node only, the derivatives of its children are LazyDerivative nodes, defined in helpers.cpp
+EquationBase* derivative_step_equation_base(const EquationBase* eq, const SYMCALC_VAR_NAME_TYPE& var);
+
+// Simplify or differentiate every child of a node, on the pool of the context for children of at least parallel_threshold nodes, defined in helpers.cpp
+// Children that don't depend on the variable get a nullptr derivative
+std::vector<EquationBase*> simplify_children(const std::vector<EquationBase*>& children);
+std::vector<EquationBase*> derivative_children(const std::vector<EquationBase*>& children, const SYMCALC_VAR_NAME_TYPE& var);
+// Whether the functions above would send some of the children to the pool, so nodes can stop early when they don't
+bool forks_children(const std::vector<EquationBase*>& children);
+
+// Partial derivatives with respect to each variable, built by reverse accumulation so they share the adjoints of common subtrees, defined in gradient.cpp
+std::vector<EquationBase*> gradient_equation_base(const EquationBase* eq, const std::vector<SYMCALC_VAR_NAME_TYPE>& variables);
+
+// Replaces variables with the given nodes, folding nodes whose children all became numbers
+// and the numbers among the children of sums and products, defined in substitute.cpp
+EquationBase* substitute_equation_base(const EquationBase* eq, const std::map<SYMCALC_VAR_NAME_TYPE, const EquationBase*>& replacements);
+
+
+// Bounded, thread-safe table of results keyed by the structure of an EquationBase, defined in cache.cpp
+// Entries are evicted in least-recently-used order once the capacity is reached, a capacity of zero disables the cache
+// Keys are spread over shards with a lock each, so threads that simplify or differentiate at once rarely wait on each other
+class EquationCache{
+public:
+	static const size_t SHARDS_COUNT = 16;
+	
+	EquationCache(size_t capacity = 10000);
+	~EquationCache();
+	
+	// Returns a new reference to the stored result, or nullptr if the node isn't cached
+	// The tag tells apart results of the same node, like derivatives with respect to different variables
+	EquationBase* find(const EquationBase* key, const std::string& tag = "");
+	void insert(const EquationBase* key, const EquationBase* value, const std::string& tag = "");
+	void clear();
+	
+	size_t size() const;
+	size_t capacity() const;
+	// Every shard holds at most its share of the capacity
+	void set_capacity(size_t capacity);
+	
+private:
+	struct Entry{
+		EquationBase* key;
+		std::string tag;
+		size_t hash_value; // Hash of the key and the tag
+		EquationBase* value;
+	};
+	
+	struct Shard{
+		std::list<Entry> entries; // Most recently used first
+		std::unordered_multimap<size_t, std::list<Entry>::iterator> index;
+		mutable std::mutex mutex;
+	};
+	
+	Shard shards[SHARDS_COUNT];
+	std::atomic<size_t> max_entries;
+	
+	void _evict(Shard& shard, size_t max_size);
+};
+
+// Cache used by simplify_equation_base(), shared by all threads, defined in cache.cpp
+EquationCache& simplify_cache();
+// Cache used by derivative_equation_base(), tagged with the variable, shared by all threads, defined in cache.cpp
+EquationCache& derivative_cache();
+
+
+class ThreadPool;
+
+// Settings used while building, differentiating and simplifying expressions, defined in context.cpp
+// Every thread has its own current context, so threads can use different settings at the same time,
+// and nodes are immutable with atomic reference counts, so expressions can be built and shared by several threads
+// Threads start from a default context
+struct Context{
+	bool auto_simplify; // Simplify the expressions made by operators and functions, and every order of derivative()
+	
+	// Tables of simplified nodes and derivatives, nullptr uses the ones shared by all threads
+	EquationCache* simplify_cache;
+	EquationCache* derivative_cache;
+	
+	// Sums and products with at least two children of parallel_threshold nodes or more simplify and differentiate them on the pool
+	// nullptr keeps everything on the calling thread
+	ThreadPool* pool;
+	size_t parallel_threshold;
+	
+	// Once the flag is set, differentiation and simplification stop early with placeholder results that aren't cached,
+	// and the operation that set the flag throws OperationCancelled, nullptr can't be cancelled
+	const std::atomic<bool>* cancelled;
+	
+	Context();
+	
+	EquationCache& simplifications() const;
+	EquationCache& derivatives() const;
+	
+	// Context of the calling thread
+	static Context& current();
+};
+
+// Thrown by work that was cancelled through its Context
+struct OperationCancelled : public std::runtime_error{
+	OperationCancelled();
+};
+
+// Makes a context current for the calling thread until the end of the scope, then restores the previous one
+class ContextScope{
+public:
+	Context previous;
+	
+	ContextScope(const Context& context);
+	ContextScope(const ContextScope&) = delete;
+	ContextScope& operator=(const ContextScope&) = delete;
+	~ContextScope();
+};
+
+
+class CompiledEquation;
+class SparseHessian;
+template<typename T> class AsyncHandle;
+
 
 // Equation class, defined in equation.cpp
 class Equation{
@@ -461,17 +776,53 @@ public:
 	
 	Equation derivative(Equation variable, size_t order = 1) const;
 	Equation derivative(size_t order=1) const;
+	// Lightweight view of the derivative, evaluated in forward or Taylor mode and only built where it is inspected, simplified or compiled
+	// Mixed derivatives, views of views on other variables, build the inner derivative when they are evaluated
+	// Isn't simplified on creation, even with auto_simplify in the context
+	Equation lazy_derivative(Equation variable, size_t order = 1) const;
+	
+	// All partial derivatives at once, common subexpressions are shared between them
+	std::vector<Equation> gradient(const std::vector<Equation>& variables) const;
+	// Second derivatives with respect to many variables, only the nonzeros are computed
+	SparseHessian hessian(const std::vector<Equation>& variables) const;
 	
 	Equation simplify() const;
 	
+	Equation expand() const;
+	
+	// Replace variables with expressions, unchanged subtrees are shared with the original expression
+	Equation substitute(std::map<Equation, Equation> replacements) const;
+	// Replace variables with values and fold every subtree that becomes constant
+	Equation specialize(std::map<Equation, SYMCALC_VALUE_TYPE> values) const;
+	
+	CompiledEquation compile(const std::vector<Equation>& variables, const std::vector<Equation>& parameters = std::vector<Equation>()) const;
+	
+	// Same as derivative(), simplify() and compile(), run on async_pool() with the Context of the calling thread
+	AsyncHandle<Equation> derivative_async(Equation variable, size_t order = 1) const;
+	AsyncHandle<Equation> simplify_async() const;
+	AsyncHandle<CompiledEquation> compile_async(const std::vector<Equation>& variables, const std::vector<Equation>& parameters = std::vector<Equation>()) const;
+	
 	std::vector<Equation> list_variables() const;
 	std::vector<std::string> list_variables_str() const;
 	
-	SYMCALC_VALUE_TYPE eval(SYMCALC_VAR_HASH_TYPE var_hash) const;
-	SYMCALC_VALUE_TYPE eval(std::map<Equation, SYMCALC_VALUE_TYPE> var_hash) const;
+	// Values by variable name don't allocate, values by Equation are converted to names on every call
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const;
+	SYMCALC_VALUE_TYPE eval(const std::map<Equation, SYMCALC_VALUE_TYPE>& var_hash) const;
 	SYMCALC_VALUE_TYPE eval() const;
-	SYMCALC_VALUE_TYPE operator()(SYMCALC_VAR_HASH_TYPE var_hash) const;
-	SYMCALC_VALUE_TYPE operator()(std::map<Equation, SYMCALC_VALUE_TYPE> var_hash) const;
+	
+	// Forward-mode evaluation, gives the value and the directional derivatives J·v in one pass without building derivative trees
+	Dual eval_dual(std::map<Equation, Dual> var_hash) const;
+	// Each direction gives the component of every variable, variables left out have a zero component
+	Dual eval_dual(SYMCALC_VAR_HASH_TYPE var_hash, std::vector<SYMCALC_VAR_HASH_TYPE> directions) const;
+	
+	// Taylor-mode evaluation, all derivatives up to the order at a point in O(order^2 * size) without building derivative trees
+	// Other variables are fixed to the given values
+	TaylorSeries taylor_coefficients(Equation variable, SYMCALC_VALUE_TYPE point, size_t order, SYMCALC_VAR_HASH_TYPE values = SYMCALC_VAR_HASH_TYPE()) const;
+	std::vector<SYMCALC_VALUE_TYPE> derivatives_at(Equation variable, SYMCALC_VALUE_TYPE point, size_t order, SYMCALC_VAR_HASH_TYPE values = SYMCALC_VAR_HASH_TYPE()) const;
+	// Series polynomial in powers of (variable - point)
+	Equation taylor(Equation variable, SYMCALC_VALUE_TYPE point, size_t order, SYMCALC_VAR_HASH_TYPE values = SYMCALC_VAR_HASH_TYPE()) const;
+	SYMCALC_VALUE_TYPE operator()(const SYMCALC_VAR_HASH_TYPE& var_hash) const;
+	SYMCALC_VALUE_TYPE operator()(const std::map<Equation, SYMCALC_VALUE_TYPE>& var_hash) const;
 	SYMCALC_VALUE_TYPE operator()() const;
 
 	std::string type() const;
@@ -493,11 +844,521 @@ Equation sin(const Equation eq);
 Equation cos(const Equation eq);
 
 
+// Jacobian of a list of expressions, one gradient per row, defined in gradient.cpp
+std::vector<std::vector<Equation>> jacobian(const std::vector<Equation>& equations, const std::vector<Equation>& variables);
+
+// Compiles several expressions into one program with an output each, defined in compiled.cpp
+CompiledEquation compile(const std::vector<Equation>& equations, const std::vector<Equation>& variables, const std::vector<Equation>& parameters = std::vector<Equation>());
+
+
+
+// Sparse multivariate polynomial with numeric coefficients, defined in polynomial.cpp
+// Monomials are exponent vectors aligned with the sorted list of variables, stored in a hash table with their coefficients
+class Polynomial{
+public:
+	typedef std::vector<unsigned int> Monomial;
+	
+	struct MonomialHash{
+		size_t operator()(const Monomial& monomial) const;
+	};
+	
+	typedef std::unordered_map<Monomial, SYMCALC_VALUE_TYPE, MonomialHash> TermTable;
+	
+	std::vector<SYMCALC_VAR_NAME_TYPE> variables;
+	TermTable terms;
+	
+	Polynomial();
+	Polynomial(SYMCALC_VALUE_TYPE constant);
+	
+	static Polynomial variable(SYMCALC_VAR_NAME_TYPE name);
+	
+	// Conversion from an expression, returns false if the expression isn't a polynomial, named constants are read as their values
+	static bool from_equation_base(const EquationBase* eq, Polynomial& result);
+	static bool from_equation(const Equation& eq, Polynomial& result);
+	
+	EquationBase* to_equation_base() const;
+	Equation to_equation() const;
+	
+	friend Polynomial operator+(const Polynomial& p1, const Polynomial& p2);
+	friend Polynomial operator-(const Polynomial& p1, const Polynomial& p2);
+	friend Polynomial operator*(const Polynomial& p1, const Polynomial& p2);
+	friend Polynomial operator-(const Polynomial& p1);
+	
+	Polynomial pow(unsigned int power) const;
+	Polynomial derivative(const SYMCALC_VAR_NAME_TYPE& var) const;
+	
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const;
+	
+	unsigned int degree(const SYMCALC_VAR_NAME_TYPE& var) const;
+	unsigned int degree() const;
+	size_t size() const;
+	bool is_constant() const;
+	SYMCALC_VALUE_TYPE constant_value() const;
+	
+	// Copy of the polynomial with monomials aligned to a superset of its variables
+	Polynomial _aligned(const std::vector<SYMCALC_VAR_NAME_TYPE>& new_variables) const;
+	void _remove_zeros();
+};
+
+// Expands products and powers of polynomial subtrees, used by Equation::expand(), defined in polynomial.cpp
+// The polynomial factors of a product are expanded next to the others, named constants such as pi stay symbolic
+EquationBase* expand_equation_base(const EquationBase* eq);
+
+
+
+// Expression compiled into a linear program over registers, defined in compiled.cpp
+// Variables are inputs given for every evaluation, parameters are set with set_parameters() and kept between evaluations
+// Subexpressions that don't depend on the inputs are hoisted into a parameter program, which only runs when parameters change
+// Polynomial subtrees written as sums of monomials are evaluated with Horner's scheme, or with Estrin's scheme in eval_batch()
+class CompiledEquation{
+public:
+	enum Opcode{
+		OP_ADD,
+		OP_NEG,
+		OP_MULT,
+		OP_DIV,
+		OP_POW,
+		OP_LOG,
+		OP_LN,
+		OP_EXP,
+		OP_ABS,
+		OP_SIN,
+		OP_COS,
+		OP_HORNER // Polynomial in register a, coefficient registers from the lowest power are operands[begin, begin + count)
+	};
+	
+	struct Instruction{
+		Opcode op;
+		size_t a;
+		size_t b;
+		size_t begin;
+		size_t count;
+	};
+	
+	static const unsigned int MAX_POLYNOMIAL_DEGREE = 64;
+	static const size_t MAX_POLYNOMIAL_TERMS = 64;
+	
+	std::vector<SYMCALC_VAR_NAME_TYPE> variables;
+	std::vector<SYMCALC_VAR_NAME_TYPE> parameters;
+	
+	// Parameter program, registers hold the parameters, then the constants, then one result per instruction
+	std::vector<SYMCALC_VALUE_TYPE> constants;
+	std::vector<Instruction> parameter_instructions;
+	std::vector<SYMCALC_VALUE_TYPE> parameter_registers;
+	std::vector<size_t> invariant_sources; // Registers of the parameter program copied into the invariants
+	
+	// Evaluation program, registers hold the inputs, then the invariants, then one result per instruction
+	std::vector<SYMCALC_VALUE_TYPE> invariants;
+	std::vector<Instruction> instructions;
+	std::vector<size_t> operands; // Shared by both programs
+	std::vector<size_t> outputs; // One register per equation
+	
+	// Parameters start at zero
+	CompiledEquation(const Equation& equation, const std::vector<Equation>& variables, const std::vector<Equation>& parameters = std::vector<Equation>());
+	// Program with one output per equation, like a function with its derivatives, a gradient or a Jacobian
+	// Common subexpressions are eliminated across all the equations, even when they aren't shared nodes, so each is evaluated once
+	CompiledEquation(const std::vector<Equation>& equations, const std::vector<Equation>& variables, const std::vector<Equation>& parameters = std::vector<Equation>());
+	
+	// Runs the parameter program, values are given in the order of the parameters
+	void set_parameters(const std::vector<SYMCALC_VALUE_TYPE>& values);
+	void set_parameters(const SYMCALC_VALUE_TYPE* values);
+	
+	// Number of values needed by eval() with a workspace
+	size_t workspace_size() const;
+	
+	// Value of the first output
+	// The versions with a workspace never allocate, so they are the ones to use on latency-sensitive paths,
+	// the versions with vectors allocate a workspace on every call
+	SYMCALC_VALUE_TYPE eval(const std::vector<SYMCALC_VALUE_TYPE>& inputs) const;
+	SYMCALC_VALUE_TYPE eval(const SYMCALC_VALUE_TYPE* inputs, SYMCALC_VALUE_TYPE* workspace) const;
+	SYMCALC_VALUE_TYPE operator()(const std::vector<SYMCALC_VALUE_TYPE>& inputs) const;
+	
+	// Values of all the outputs, in the order of the equations
+	std::vector<SYMCALC_VALUE_TYPE> eval_all(const std::vector<SYMCALC_VALUE_TYPE>& inputs) const;
+	void eval_all(const SYMCALC_VALUE_TYPE* inputs, SYMCALC_VALUE_TYPE* results, SYMCALC_VALUE_TYPE* workspace) const;
+	
+	// Evaluates rows of inputs stored one after another, each row gives one result per output
+	void eval_batch(const SYMCALC_VALUE_TYPE* inputs, size_t rows, SYMCALC_VALUE_TYPE* results) const;
+	
+	// Reverse-mode differentiation: one forward sweep over the instructions, then one backward sweep accumulating adjoints
+	// The gradient is with respect to the inputs, in the order of the variables, and needs a program with a single output
+	SYMCALC_VALUE_TYPE value_and_gradient(const std::vector<SYMCALC_VALUE_TYPE>& inputs, std::vector<SYMCALC_VALUE_TYPE>& gradient) const;
+	SYMCALC_VALUE_TYPE value_and_gradient(const SYMCALC_VALUE_TYPE* inputs, SYMCALC_VALUE_TYPE* gradient, SYMCALC_VALUE_TYPE* workspace) const;
+	// Number of values needed by value_and_gradient() with a workspace, the registers followed by their adjoints
+	size_t gradient_workspace_size() const;
+	
+	// Forward-mode differentiation: one sweep gives the derivative of every output along a direction of the inputs
+	// Uses a workspace of gradient_workspace_size(), the registers followed by their tangents
+	std::vector<SYMCALC_VALUE_TYPE> jacobian_vector_product(const std::vector<SYMCALC_VALUE_TYPE>& inputs, const std::vector<SYMCALC_VALUE_TYPE>& direction) const;
+	void jacobian_vector_product(const SYMCALC_VALUE_TYPE* inputs, const SYMCALC_VALUE_TYPE* direction, SYMCALC_VALUE_TYPE* results, SYMCALC_VALUE_TYPE* workspace) const;
+	
+	// Hessian times a direction without forming the Hessian, costs a small multiple of one gradient for any number of variables
+	// Needs a program with a single output, the workspace holds the registers, their tangents, their adjoints and the tangents of the adjoints
+	std::vector<SYMCALC_VALUE_TYPE> hessian_vector_product(const std::vector<SYMCALC_VALUE_TYPE>& inputs, const std::vector<SYMCALC_VALUE_TYPE>& direction) const;
+	void hessian_vector_product(const SYMCALC_VALUE_TYPE* inputs, const SYMCALC_VALUE_TYPE* direction, SYMCALC_VALUE_TYPE* product, SYMCALC_VALUE_TYPE* workspace) const;
+	size_t hessian_vector_workspace_size() const;
+	
+	SYMCALC_VALUE_TYPE _run_instruction(const Instruction& instruction, const SYMCALC_VALUE_TYPE* registers, bool use_estrin) const;
+	void _run(const std::vector<Instruction>& program, SYMCALC_VALUE_TYPE* registers, SYMCALC_VALUE_TYPE* results, bool use_estrin) const;
+	void _run_adjoints(const SYMCALC_VALUE_TYPE* registers, SYMCALC_VALUE_TYPE* adjoints) const;
+	void _run_tangents(const SYMCALC_VALUE_TYPE* registers, SYMCALC_VALUE_TYPE* tangents) const;
+	void _run_adjoint_tangents(const SYMCALC_VALUE_TYPE* registers, const SYMCALC_VALUE_TYPE* tangents, SYMCALC_VALUE_TYPE* adjoints, SYMCALC_VALUE_TYPE* adjoint_tangents) const;
+};
+
+
+
+// Sparse Hessian of an expression, defined in hessian.cpp
+// The sparsity pattern is found from the variables each node depends on, then columns that never share a row get the same color
+// Every color is recovered with one forward sweep over the compiled gradient, so the cost grows with the colors instead of the variables
+class SparseHessian{
+public:
+	std::vector<SYMCALC_VAR_NAME_TYPE> variables;
+	
+	// Pattern of the full symmetric matrix, row_offsets and columns give the CSR form, rows and columns give the COO form
+	std::vector<size_t> row_offsets;
+	std::vector<size_t> rows;
+	std::vector<size_t> columns;
+	
+	std::vector<size_t> colors; // Color of every column
+	size_t colors_count;
+	std::vector<std::vector<size_t>> color_entries; // Nonzeros recovered by the sweep of every color
+	
+	CompiledEquation gradient;
+	
+	SparseHessian(const Equation& equation, const std::vector<Equation>& variables);
+	
+	size_t nonzeros() const;
+	
+	// Values of the nonzeros, in the order of columns
+	std::vector<SYMCALC_VALUE_TYPE> eval(const std::vector<SYMCALC_VALUE_TYPE>& inputs) const;
+	void eval(const SYMCALC_VALUE_TYPE* inputs, SYMCALC_VALUE_TYPE* values, SYMCALC_VALUE_TYPE* workspace) const;
+	// Number of values needed by eval() with a workspace
+	size_t workspace_size() const;
+};
+
+
+
+// Spreadsheet-style evaluator that keeps the registers of a compiled program between evaluations, defined in incremental.cpp
+// Setting an input only marks it as changed, the next eval() reruns the instructions on paths from the changed inputs
+// to the outputs, and stops along a path as soon as an instruction gives the same value as before
+class IncrementalEvaluator{
+public:
+	CompiledEquation program;
+	std::vector<SYMCALC_VALUE_TYPE> registers;
+	
+	std::vector<std::vector<size_t>> affected; // Instructions that depend on each input, in program order
+	std::vector<size_t> changed_inputs;
+	std::vector<bool> changed_registers;
+	
+	size_t last_recomputed; // Instructions rerun by the last eval()
+	
+	// Inputs start at the given values, or at zero
+	IncrementalEvaluator(const CompiledEquation& program, const std::vector<SYMCALC_VALUE_TYPE>& values = std::vector<SYMCALC_VALUE_TYPE>());
+	IncrementalEvaluator(const Equation& equation, const std::vector<Equation>& variables, const std::vector<SYMCALC_VALUE_TYPE>& values = std::vector<SYMCALC_VALUE_TYPE>());
+	
+	// Inputs are given by their index in the variables of the program, or by the variable
+	void set(size_t input, SYMCALC_VALUE_TYPE value);
+	void set(const Equation& variable, SYMCALC_VALUE_TYPE value);
+	SYMCALC_VALUE_TYPE get(size_t input) const;
+	
+	// Reruns the parameter program and every instruction
+	void set_parameters(const std::vector<SYMCALC_VALUE_TYPE>& values);
+	
+	// Value of the first output, or of all the outputs
+	SYMCALC_VALUE_TYPE eval();
+	std::vector<SYMCALC_VALUE_TYPE> eval_all();
+	
+	void _update();
+	void _recompute_all();
+};
+
+
+
+// Bounded cache of the results of a compiled program by input vector, defined in memo.cpp
+// Inputs match only when they are bitwise equal, so a hit gives exactly what eval_all() would
+// Full caches evict with CLOCK: every slot has a bit set on a hit, and the hand skips and clears set bits until it finds an unset one
+// Not safe to use from several threads at once, each thread should have its own
+class MemoizedEquation{
+public:
+	struct InputsHash{
+		size_t operator()(const std::vector<SYMCALC_VALUE_TYPE>& inputs) const;
+	};
+	struct InputsEqual{
+		bool operator()(const std::vector<SYMCALC_VALUE_TYPE>& inputs1, const std::vector<SYMCALC_VALUE_TYPE>& inputs2) const;
+	};
+	typedef std::unordered_map<std::vector<SYMCALC_VALUE_TYPE>, size_t, InputsHash, InputsEqual> SlotMap;
+	
+	CompiledEquation program;
+	size_t capacity;
+	
+	SlotMap slots; // Inputs to the slot that holds their results, never rehashed so the iterators stay valid
+	std::vector<SlotMap::iterator> slot_entries;
+	std::vector<SYMCALC_VALUE_TYPE> results; // One row of outputs per slot
+	std::vector<bool> referenced;
+	size_t hand;
+	
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	
+	std::vector<SYMCALC_VALUE_TYPE> workspace;
+	
+	MemoizedEquation(const CompiledEquation& program, size_t capacity = 1024);
+	MemoizedEquation(const Equation& equation, const std::vector<Equation>& variables, size_t capacity = 1024);
+	
+	// Value of the first output, or of all the outputs
+	SYMCALC_VALUE_TYPE eval(const std::vector<SYMCALC_VALUE_TYPE>& inputs);
+	std::vector<SYMCALC_VALUE_TYPE> eval_all(const std::vector<SYMCALC_VALUE_TYPE>& inputs);
+	SYMCALC_VALUE_TYPE operator()(const std::vector<SYMCALC_VALUE_TYPE>& inputs);
+	
+	// Cached results depend on the parameters, so changing them empties the cache
+	void set_parameters(const std::vector<SYMCALC_VALUE_TYPE>& values);
+	
+	// Drops every result, the counters are kept
+	void clear();
+	void reset_counters();
+	double hit_rate() const;
+	size_t size() const;
+	
+	const SYMCALC_VALUE_TYPE* _lookup(const std::vector<SYMCALC_VALUE_TYPE>& inputs);
+	size_t _free_slot();
+};
+
+
+
+// Compiled programs and derivative artifacts shared by all threads, keyed by the structure of the expressions, defined in cache.cpp
+// The table is split into shards with their own lock and least-recently-used order, so threads asking for different
+// expressions rarely wait on each other, and a lock is only held to find or insert an entry, never while compiling
+// Concurrent requests for the same key build it once, the other threads wait for that result
+// Results are shared and immutable, an evicted program stays valid for as long as someone holds it
+class ProgramCache{
+public:
+	struct Stats{
+		size_t hits;
+		size_t misses;
+		size_t evictions;
+		size_t entries;
+	};
+	
+	static const size_t SHARDS_COUNT = 16;
+	
+	ProgramCache(size_t capacity = 1000);
+	~ProgramCache();
+	
+	std::shared_ptr<const CompiledEquation> compiled(const Equation& equation, const std::vector<Equation>& variables, const std::vector<Equation>& parameters = std::vector<Equation>());
+	std::shared_ptr<const CompiledEquation> compiled(const std::vector<Equation>& equations, const std::vector<Equation>& variables, const std::vector<Equation>& parameters = std::vector<Equation>());
+	// Program with one output per partial derivative, in the order of the variables
+	std::shared_ptr<const CompiledEquation> gradient(const Equation& equation, const std::vector<Equation>& variables);
+	std::shared_ptr<const SparseHessian> hessian(const Equation& equation, const std::vector<Equation>& variables);
+	
+	Stats stats() const;
+	void reset_stats();
+	void clear();
+	
+	size_t size() const;
+	size_t capacity() const;
+	// Every shard holds at most its share of the capacity, a capacity of zero disables the cache
+	void set_capacity(size_t capacity);
+	
+private:
+	typedef std::shared_ptr<const void> Artifact;
+	
+	struct Entry{
+		std::string tag;
+		std::vector<EquationBase*> nodes; // The equations, then the variables, then the parameters
+		size_t equations_count;
+		size_t variables_count;
+		size_t hash_value;
+		size_t id;
+		std::shared_future<Artifact> result;
+	};
+	
+	struct Shard{
+		std::list<Entry> entries; // Most recently used first
+		std::unordered_multimap<size_t, std::list<Entry>::iterator> index;
+		mutable std::mutex mutex;
+	};
+	
+	Shard shards[SHARDS_COUNT];
+	std::atomic<size_t> max_entries;
+	std::atomic<size_t> next_id;
+	std::atomic<size_t> hits;
+	std::atomic<size_t> misses;
+	std::atomic<size_t> evictions;
+	
+	Artifact _find_or_build(const std::string& tag, const std::vector<Equation>& equations, const std::vector<Equation>& variables, const std::vector<Equation>& parameters, const std::function<Artifact()>& build);
+	void _erase(Shard& shard, std::list<Entry>::iterator entry);
+	void _evict(Shard& shard, size_t max_size);
+};
+
+// Cache of compiled programs shared by the whole process, defined in cache.cpp
+ProgramCache& program_cache();
+
+
+
+// Fixed set of worker threads, defined in parallel.cpp
+// The thread that calls parallel_for() works on the indices too, so calling it from inside a task can't deadlock
+// Tasks run with the Context of the calling thread
+class ThreadPool{
+public:
+	// Zero uses one thread per core, the calling thread counts as one of them
+	ThreadPool(size_t threads = 0);
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	~ThreadPool();
+	
+	// Threads that work on a parallel_for(), including the calling one
+	size_t size() const;
+	
+	// Runs task(i) for every i below count and returns once all are done
+	// If tasks throw, the rest are skipped and the first exception is rethrown
+	// While others finish its indices, the calling thread runs pending jobs, so nested calls keep every thread busy
+	void parallel_for(size_t count, const std::function<void(size_t)>& task);
+	
+	// Queues a task for a worker and returns right away, pools without workers run it on the calling thread
+	// Exceptions thrown by the task are dropped
+	void submit(const std::function<void()>& task);
+	
+private:
+	struct Job;
+	
+	std::vector<std::thread> workers;
+	std::deque<std::shared_ptr<Job>> jobs;
+	std::mutex mutex;
+	std::condition_variable job_added;
+	bool stopping;
+	
+	void _work();
+	std::shared_ptr<Job> _take_job();
+};
+
+// Pool shared by the whole process, with one thread per core, defined in parallel.cpp
+ThreadPool& thread_pool();
+// Pool for asynchronous operations, it has at least one worker so they never run on the calling thread, defined in parallel.cpp
+ThreadPool& async_pool();
+
+
+// Operations applied to every equation by process_equations(), defined in parallel.cpp
+struct BulkRequest{
+	std::vector<Equation> derivatives; // One first derivative per variable
+	bool simplify; // Simplify the equation, then every derivative
+	bool compile; // One program with the equation followed by its derivatives as outputs
+	std::vector<Equation> variables; // Inputs of the programs, the variables of the equation if empty
+	
+	BulkRequest();
+};
+
+struct BulkResult{
+	Equation equation;
+	std::vector<Equation> derivatives;
+	std::shared_ptr<const CompiledEquation> program; // nullptr if compilation wasn't requested
+	
+	BulkResult();
+};
+
+// Processes the equations on the pool, results are in the order of the equations and don't depend on the number of threads
+std::vector<BulkResult> process_equations(const std::vector<Equation>& equations, const BulkRequest& request, ThreadPool& pool = thread_pool());
+
+
+
+// Compiled formula that can be replaced while other threads evaluate it, defined in published.cpp
+// Writers publish a new program and bump the version, readers keep a Reader per thread that holds a snapshot
+// and only reloads it when the version changed, so evaluating takes one atomic load and no locks
+// Old programs are released once the last reader that holds them moves on
+class PublishedEquation{
+public:
+	typedef std::shared_ptr<const CompiledEquation> Snapshot;
+	
+	// Handle for one thread, the program it gives stays valid until the next call on the same reader
+	class Reader{
+	public:
+		Reader(const PublishedEquation& source);
+		
+		const CompiledEquation& get();
+		const CompiledEquation* operator->();
+		SYMCALC_VALUE_TYPE eval(const std::vector<SYMCALC_VALUE_TYPE>& inputs);
+		
+		// Version seen by the last get(), the program it returned is at least that recent
+		size_t version() const;
+		
+	private:
+		const PublishedEquation* source;
+		Snapshot current;
+		size_t current_version;
+	};
+	
+	PublishedEquation(const CompiledEquation& program);
+	PublishedEquation(const Equation& equation, const std::vector<Equation>& variables, const std::vector<Equation>& parameters = std::vector<Equation>());
+	PublishedEquation(const PublishedEquation&) = delete;
+	PublishedEquation& operator=(const PublishedEquation&) = delete;
+	
+	// Equations are compiled before anything is replaced
+	void publish(Snapshot program);
+	void publish(const CompiledEquation& program);
+	void publish(const Equation& equation, const std::vector<Equation>& variables, const std::vector<Equation>& parameters = std::vector<Equation>());
+	
+	// Current program without a reader, for threads that evaluate rarely
+	Snapshot snapshot() const;
+	size_t version() const;
+	
+private:
+	Snapshot current;
+	std::atomic<size_t> current_version;
+	std::mutex publish_mutex;
+};
+
+
+
+// Progress and cancellation of an asynchronous operation, shared by the operation and its handles, defined in async.cpp
+struct AsyncState{
+	std::atomic<bool> cancelled;
+	std::atomic<size_t> steps_done;
+	size_t steps_count;
+	
+	AsyncState(size_t steps_count);
+};
+
+// Handle to the result of an asynchronous operation, copies refer to the same operation
+// Cancelling stops the operation at the next node it differentiates or simplifies, get() then throws OperationCancelled
+// Compilation only checks before it starts
+template<typename T> class AsyncHandle{
+public:
+	std::shared_future<T> result;
+	std::shared_ptr<AsyncState> state;
+	
+	AsyncHandle(std::shared_future<T> result, std::shared_ptr<AsyncState> state) : result(result), state(state) {}
+	
+	// Waits for the result, rethrows the exception of the operation
+	const T& get() const{
+		return result.get();
+	}
+	void wait() const{
+		result.wait();
+	}
+	bool ready() const{
+		return result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}
+	
+	void cancel(){
+		state->cancelled.store(true, std::memory_order_relaxed);
+	}
+	bool cancelled() const{
+		return state->cancelled.load(std::memory_order_relaxed);
+	}
+	// Fraction of the steps that are done, like the orders of a derivative
+	double progress() const{
+		if(state->steps_count == 0) return ready() ? 1 : 0;
+		return (double)state->steps_done.load(std::memory_order_relaxed) / state->steps_count;
+	}
+};
+
+
 // Constants, defined in symcalc.cpp
 
+// Read-only, so every thread can use them
 namespace Constants{
-	extern Equation Pi;
-	extern Equation E;
+	extern const Equation Pi;
+	extern const Equation E;
 }
 
 } // End of symcalc namespace
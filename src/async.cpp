@@ -0,0 +1,92 @@
+// Copyright 2024 Kyrylo Shyshko
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symcalc/symcalc.hpp"
+#include <exception>
+
+//
+// async.cpp:
+// Asynchronous differentiation, simplification and compilation of equations
+// The operations run the synchronous ones on async_pool(), with a copy of the Context of the calling thread
+// that points to the cancellation flag of the operation
+//
+
+namespace symcalc{
+
+
+AsyncState::AsyncState(size_t steps_count) : cancelled(false), steps_done(0), steps_count(steps_count) {}
+
+
+template<typename T> static AsyncHandle<T> run_async(size_t steps_count, const std::function<T(AsyncState&)>& work){
+	std::shared_ptr<AsyncState> state = std::make_shared<AsyncState>(steps_count);
+	std::shared_ptr<std::promise<T>> promise = std::make_shared<std::promise<T>>();
+	AsyncHandle<T> handle (promise->get_future().share(), state);
+	
+	Context context = Context::current();
+	context.cancelled = &state->cancelled;
+	
+	async_pool().submit([state, promise, context, work](){
+		ContextScope scope (context);
+		try{
+			if(state->cancelled.load(std::memory_order_relaxed)){
+				throw OperationCancelled();
+			}
+			T result = work(*state);
+			// A cancelled operation finishes with placeholders, see Context::cancelled
+			if(state->cancelled.load(std::memory_order_relaxed)){
+				throw OperationCancelled();
+			}
+			promise->set_value(result);
+		}catch(...){
+			promise->set_exception(std::current_exception());
+		}
+	});
+	return handle;
+}
+
+
+
+// One step per order, the same derivatives as derivative() with the same simplification between them
+AsyncHandle<Equation> Equation::derivative_async(Equation variable, size_t order) const{
+	Equation equation = *this;
+	return run_async<Equation>(order, [equation, variable, order](AsyncState& state){
+		Equation result = equation;
+		for(size_t i = 0; i < order; i++){
+			result = result.derivative(variable);
+			state.steps_done.fetch_add(1, std::memory_order_relaxed);
+		}
+		return result;
+	});
+}
+
+AsyncHandle<Equation> Equation::simplify_async() const{
+	Equation equation = *this;
+	return run_async<Equation>(1, [equation](AsyncState& state){
+		Equation result = equation.simplify();
+		state.steps_done.fetch_add(1, std::memory_order_relaxed);
+		return result;
+	});
+}
+
+AsyncHandle<CompiledEquation> Equation::compile_async(const std::vector<Equation>& variables, const std::vector<Equation>& parameters) const{
+	Equation equation = *this;
+	return run_async<CompiledEquation>(1, [equation, variables, parameters](AsyncState& state){
+		CompiledEquation result (equation, variables, parameters);
+		state.steps_done.fetch_add(1, std::memory_order_relaxed);
+		return result;
+	});
+}
+
+
+} // End of symcalc namespace
@@ -0,0 +1,325 @@
+// Copyright 2024 Kyrylo Shyshko
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symcalc/symcalc.hpp"
+#include <exception>
+
+//
+// cache.cpp:
+// Definitions for EquationCache, the sharded memo table of results keyed by the structure of an expression,
+// and for ProgramCache, the sharded table of compiled programs shared by all threads
+//
+
+namespace symcalc{
+
+
+EquationCache::EquationCache(size_t capacity) : max_entries(capacity) {}
+
+EquationCache::~EquationCache(){
+	clear();
+}
+
+
+static size_t tagged_hash(const EquationBase* key, const std::string& tag){
+	return tag.empty() ? key->hash_value : hash_combine(key->hash_value, std::hash<std::string>()(tag));
+}
+
+
+EquationBase* EquationCache::find(const EquationBase* key, const std::string& tag){
+	size_t hash = tagged_hash(key, tag);
+	Shard& shard = shards[hash % SHARDS_COUNT];
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	
+	auto range = shard.index.equal_range(hash);
+	for(auto it = range.first; it != range.second; it++){
+		std::list<Entry>::iterator entry = it->second;
+		if(entry->tag == tag && equal(entry->key, key)){
+			shard.entries.splice(shard.entries.begin(), shard.entries, entry); // Mark as most recently used
+			return copy(entry->value);
+		}
+	}
+	
+	return nullptr;
+}
+
+
+void EquationCache::insert(const EquationBase* key, const EquationBase* value, const std::string& tag){
+	size_t shard_capacity = (capacity() + SHARDS_COUNT - 1) / SHARDS_COUNT;
+	if(shard_capacity == 0) return;
+	
+	size_t hash = tagged_hash(key, tag);
+	Shard& shard = shards[hash % SHARDS_COUNT];
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	
+	// Another thread could have inserted the same key in the meantime
+	auto range = shard.index.equal_range(hash);
+	for(auto it = range.first; it != range.second; it++){
+		if(it->second->tag == tag && equal(it->second->key, key)){
+			return;
+		}
+	}
+	
+	_evict(shard, shard_capacity - 1);
+	
+	shard.entries.push_front(Entry{copy(key), tag, hash, copy(value)});
+	shard.index.insert(std::make_pair(hash, shard.entries.begin()));
+}
+
+
+void EquationCache::clear(){
+	for(Shard& shard : shards){
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		_evict(shard, 0);
+	}
+}
+
+
+size_t EquationCache::size() const{
+	size_t total = 0;
+	for(const Shard& shard : shards){
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		total += shard.entries.size();
+	}
+	return total;
+}
+
+size_t EquationCache::capacity() const{
+	return max_entries.load(std::memory_order_relaxed);
+}
+
+void EquationCache::set_capacity(size_t capacity){
+	max_entries.store(capacity, std::memory_order_relaxed);
+	for(Shard& shard : shards){
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		_evict(shard, (capacity + SHARDS_COUNT - 1) / SHARDS_COUNT);
+	}
+}
+
+
+// Removes the least recently used entries of the shard until at most max_size are left, expects its mutex to be locked
+void EquationCache::_evict(Shard& shard, size_t max_size){
+	while(shard.entries.size() > max_size){
+		Entry& entry = shard.entries.back();
+		
+		auto range = shard.index.equal_range(entry.hash_value);
+		for(auto it = range.first; it != range.second; it++){
+			if(it->second == std::prev(shard.entries.end())){
+				shard.index.erase(it);
+				break;
+			}
+		}
+		
+		delete_equation_base(entry.key);
+		delete_equation_base(entry.value);
+		shard.entries.pop_back();
+	}
+}
+
+
+
+EquationCache& simplify_cache(){
+	static EquationCache cache;
+	return cache;
+}
+
+EquationCache& derivative_cache(){
+	static EquationCache cache;
+	return cache;
+}
+
+
+
+ProgramCache::ProgramCache(size_t capacity) : max_entries(capacity), next_id(0), hits(0), misses(0), evictions(0) {}
+
+ProgramCache::~ProgramCache(){
+	clear();
+}
+
+
+std::shared_ptr<const CompiledEquation> ProgramCache::compiled(const Equation& equation, const std::vector<Equation>& variables, const std::vector<Equation>& parameters){
+	return compiled(std::vector<Equation>{equation}, variables, parameters);
+}
+
+std::shared_ptr<const CompiledEquation> ProgramCache::compiled(const std::vector<Equation>& equations, const std::vector<Equation>& variables, const std::vector<Equation>& parameters){
+	Artifact artifact = _find_or_build("compiled", equations, variables, parameters, [&]() -> Artifact {
+		return std::make_shared<const CompiledEquation>(equations, variables, parameters);
+	});
+	return std::static_pointer_cast<const CompiledEquation>(artifact);
+}
+
+std::shared_ptr<const CompiledEquation> ProgramCache::gradient(const Equation& equation, const std::vector<Equation>& variables){
+	Artifact artifact = _find_or_build("gradient", std::vector<Equation>{equation}, variables, std::vector<Equation>(), [&]() -> Artifact {
+		return std::make_shared<const CompiledEquation>(equation.gradient(variables), variables);
+	});
+	return std::static_pointer_cast<const CompiledEquation>(artifact);
+}
+
+std::shared_ptr<const SparseHessian> ProgramCache::hessian(const Equation& equation, const std::vector<Equation>& variables){
+	Artifact artifact = _find_or_build("hessian", std::vector<Equation>{equation}, variables, std::vector<Equation>(), [&]() -> Artifact {
+		return std::make_shared<const SparseHessian>(equation, variables);
+	});
+	return std::static_pointer_cast<const SparseHessian>(artifact);
+}
+
+
+ProgramCache::Stats ProgramCache::stats() const{
+	return Stats{hits.load(std::memory_order_relaxed), misses.load(std::memory_order_relaxed), evictions.load(std::memory_order_relaxed), size()};
+}
+
+void ProgramCache::reset_stats(){
+	hits.store(0, std::memory_order_relaxed);
+	misses.store(0, std::memory_order_relaxed);
+	evictions.store(0, std::memory_order_relaxed);
+}
+
+void ProgramCache::clear(){
+	for(Shard& shard : shards){
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		while(!shard.entries.empty()){
+			_erase(shard, std::prev(shard.entries.end()));
+		}
+	}
+}
+
+
+size_t ProgramCache::size() const{
+	size_t total = 0;
+	for(const Shard& shard : shards){
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		total += shard.entries.size();
+	}
+	return total;
+}
+
+size_t ProgramCache::capacity() const{
+	return max_entries.load(std::memory_order_relaxed);
+}
+
+void ProgramCache::set_capacity(size_t capacity){
+	max_entries.store(capacity, std::memory_order_relaxed);
+	for(Shard& shard : shards){
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		_evict(shard, (capacity + SHARDS_COUNT - 1) / SHARDS_COUNT);
+	}
+}
+
+
+// The thread that misses inserts a pending entry and builds the artifact without holding the lock,
+// threads that find the entry in the meantime wait on its future
+ProgramCache::Artifact ProgramCache::_find_or_build(const std::string& tag, const std::vector<Equation>& equations, const std::vector<Equation>& variables, const std::vector<Equation>& parameters, const std::function<Artifact()>& build){
+	size_t shard_capacity = (capacity() + SHARDS_COUNT - 1) / SHARDS_COUNT;
+	if(shard_capacity == 0){
+		return build();
+	}
+
+	std::vector<EquationBase*> nodes;
+	nodes.reserve(equations.size() + variables.size() + parameters.size());
+	size_t hash = std::hash<std::string>()(tag);
+	for(const std::vector<Equation>* group : {&equations, &variables, &parameters}){
+		hash = hash_combine(hash, group->size());
+		for(const Equation& equation : *group){
+			nodes.push_back(equation.copy_eq());
+			hash = hash_combine(hash, nodes.back()->hash_value);
+		}
+	}
+
+	Shard& shard = shards[hash % SHARDS_COUNT];
+	std::promise<Artifact> promise;
+	size_t id;
+	{
+		std::unique_lock<std::mutex> lock(shard.mutex);
+		auto range = shard.index.equal_range(hash);
+		for(auto it = range.first; it != range.second; it++){
+			std::list<Entry>::iterator entry = it->second;
+			if(entry->tag != tag || entry->equations_count != equations.size() || entry->variables_count != variables.size() || entry->nodes.size() != nodes.size()){
+				continue;
+			}
+			bool same = true;
+			for(size_t i = 0; i < nodes.size() && same; i++){
+				same = equal(entry->nodes[i], nodes[i]);
+			}
+			if(!same){
+				continue;
+			}
+
+			shard.entries.splice(shard.entries.begin(), shard.entries, entry); // Mark as most recently used
+			std::shared_future<Artifact> result = entry->result;
+			lock.unlock();
+
+			for(EquationBase* node : nodes){
+				delete_equation_base(node);
+			}
+			hits.fetch_add(1, std::memory_order_relaxed);
+			return result.get();
+		}
+
+		misses.fetch_add(1, std::memory_order_relaxed);
+		_evict(shard, shard_capacity - 1);
+		id = next_id.fetch_add(1, std::memory_order_relaxed);
+		shard.entries.push_front(Entry{tag, nodes, equations.size(), variables.size(), hash, id, promise.get_future().share()});
+		shard.index.insert(std::make_pair(hash, shard.entries.begin()));
+	}
+
+	try{
+		Artifact artifact = build();
+		promise.set_value(artifact);
+		return artifact;
+	}catch(...){
+		// Waiting threads get the error, later requests try again
+		promise.set_exception(std::current_exception());
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto range = shard.index.equal_range(hash);
+		for(auto it = range.first; it != range.second; it++){
+			if(it->second->id == id){
+				_erase(shard, it->second);
+				break;
+			}
+		}
+		throw;
+	}
+}
+
+
+// Both expect the mutex of the shard to be locked
+void ProgramCache::_erase(Shard& shard, std::list<Entry>::iterator entry){
+	auto range = shard.index.equal_range(entry->hash_value);
+	for(auto it = range.first; it != range.second; it++){
+		if(it->second == entry){
+			shard.index.erase(it);
+			break;
+		}
+	}
+	for(EquationBase* node : entry->nodes){
+		delete_equation_base(node);
+	}
+	shard.entries.erase(entry);
+}
+
+// Entries that are still being built can be evicted too, the building thread and the waiting ones keep their future
+void ProgramCache::_evict(Shard& shard, size_t max_size){
+	while(shard.entries.size() > max_size){
+		_erase(shard, std::prev(shard.entries.end()));
+		evictions.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+
+
+ProgramCache& program_cache(){
+	static ProgramCache cache;
+	return cache;
+}
+
+
+} // End of symcalc namespace
@@ -0,0 +1,1024 @@
+// Copyright 2024 Kyrylo Shyshko
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symcalc/symcalc.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+//
+// compiled.cpp:
+// Definitions for CompiledEquation, which turns an expression into a linear program over registers
+// Instructions that don't depend on the inputs are moved to a parameter program run by set_parameters()
+// Gradients with respect to the inputs are computed in reverse mode over the evaluation program, J·v products in forward mode
+// and Hessian-vector products in forward mode over the reverse sweep
+// Several equations, like the partials of a gradient, can share one program with an output per equation
+// Common subexpressions are eliminated across all the outputs, by node structure and then by instruction
+// Polynomial subtrees written as sums of monomials are detected while compiling and evaluated with Horner's or Estrin's scheme
+//
+
+namespace symcalc{
+
+
+//
+// Compilation
+//
+
+namespace{
+
+// Values are numbered while compiling and only turned into registers at the end,
+// since the number of constants isn't known until the whole expression is visited
+struct CompiledValue{
+	enum Kind {INPUT, PARAMETER, CONSTANT, INSTRUCTION};
+	Kind kind;
+	size_t index;
+	bool varying; // Depends on the inputs, so it has to run for every evaluation
+};
+
+// Upper bounds of the degree and of the number of terms of a polynomial subtree
+struct PolynomialBound{
+	int degree; // 0 for constants and -1 if the subtree isn't a polynomial
+	size_t terms;
+};
+
+// Nodes are looked up by structure, so equal subtrees that aren't shared, like the copies of f made by derivatives, compile once
+struct StructuralHash{
+	size_t operator()(const EquationBase* eq) const{
+		return eq->hash_value;
+	}
+};
+
+struct StructuralEqual{
+	bool operator()(const EquationBase* eq1, const EquationBase* eq2) const{
+		return equal(eq1, eq2);
+	}
+};
+
+// An instruction is identified by its opcode and the values it reads
+struct InstructionKeyHash{
+	size_t operator()(const std::vector<size_t>& key) const{
+		size_t hash = 0;
+		for(size_t element : key){
+			hash = hash_combine(hash, element);
+		}
+		return hash;
+	}
+};
+
+// A product of numbers and whole powers of variables, like -3 * x^2 * y / 2
+bool is_monomial(const EquationBase* eq){
+	if(eq->type == "var" || eq->type == "val" || eq->type == "const"){
+		return true;
+	}else if(eq->type == "neg"){
+		return is_monomial(eq->_child(0));
+	}else if(eq->type == "mult"){
+		for(size_t i = 0; i < eq->_children_count(); i++){
+			if(!is_monomial(eq->_child(i))) return false;
+		}
+		return true;
+	}else if(eq->type == "div"){
+		return is_monomial(eq->_child(0)) && (eq->_child(1)->type == "val" || eq->_child(1)->type == "const");
+	}else if(eq->type == "pow"){
+		return eq->_child(1)->type == "val" && is_monomial(eq->_child(0));
+	}
+	return false;
+}
+
+// Only polynomials that are already written as a sum of monomials are evaluated with Horner's scheme,
+// expanding products and powers of sums would lose precision to cancellation, like (x - 1)^4 near x = 1
+bool is_sum_of_monomials(const EquationBase* eq){
+	if(eq->type != "sum"){
+		return is_monomial(eq);
+	}
+	for(size_t i = 0; i < eq->_children_count(); i++){
+		if(!is_monomial(eq->_child(i))) return false;
+	}
+	return true;
+}
+
+
+class Compiler{
+public:
+	CompiledEquation& program;
+
+	std::vector<CompiledValue> values; // The first values are the inputs, then the parameters, in order
+	std::vector<CompiledEquation::Instruction> instructions; // Operands refer to values until finish() is called
+	std::vector<size_t> instruction_values;
+
+	std::unordered_map<const EquationBase*, size_t, StructuralHash, StructuralEqual> compiled_nodes;
+	std::unordered_map<std::vector<size_t>, size_t, InstructionKeyHash> numbered_instructions;
+	std::unordered_map<const EquationBase*, PolynomialBound> polynomial_bounds;
+	std::unordered_map<unsigned long long, size_t> constant_values; // By bit pattern, so a NaN matches itself and -0.0 isn't 0.0
+
+	Compiler(CompiledEquation& program);
+
+	size_t input(const SYMCALC_VAR_NAME_TYPE& name);
+	size_t constant(SYMCALC_VALUE_TYPE value);
+	size_t instruction(CompiledEquation::Opcode op, size_t a, size_t b);
+	size_t instruction(CompiledEquation::Opcode op, size_t a);
+	size_t fold(CompiledEquation::Opcode op, const EquationBase* eq); // Chain of binary instructions over all children
+
+	size_t compile(const EquationBase* eq);
+	size_t compile_node(const EquationBase* eq);
+	size_t compile_polynomial(const Polynomial& poly);
+	PolynomialBound polynomial_bound(const EquationBase* eq);
+
+	void finish(const std::vector<size_t>& outputs);
+	void remap(CompiledEquation::Instruction& instruction, const std::vector<size_t>& registers);
+};
+
+
+Compiler::Compiler(CompiledEquation& program) : program(program){
+	for(size_t i = 0; i < program.variables.size(); i++){
+		values.push_back(CompiledValue{CompiledValue::INPUT, i, true});
+	}
+	for(size_t i = 0; i < program.parameters.size(); i++){
+		values.push_back(CompiledValue{CompiledValue::PARAMETER, i, false});
+	}
+}
+
+
+size_t Compiler::input(const SYMCALC_VAR_NAME_TYPE& name){
+	std::vector<SYMCALC_VAR_NAME_TYPE>::const_iterator found = std::find(program.variables.begin(), program.variables.end(), name);
+	if(found != program.variables.end()){
+		return found - program.variables.begin();
+	}
+	found = std::find(program.parameters.begin(), program.parameters.end(), name);
+	if(found != program.parameters.end()){
+		return program.variables.size() + (found - program.parameters.begin());
+	}
+	throw std::runtime_error("Variable " + name + " is not an input or a parameter of the compiled equation");
+}
+
+size_t Compiler::constant(SYMCALC_VALUE_TYPE value){
+	unsigned long long bits = 0;
+	std::memcpy(&bits, &value, sizeof(value) < sizeof(bits) ? sizeof(value) : sizeof(bits));
+	std::unordered_map<unsigned long long, size_t>::iterator found = constant_values.find(bits);
+	if(found != constant_values.end()){
+		return found->second;
+	}
+	values.push_back(CompiledValue{CompiledValue::CONSTANT, program.constants.size(), false});
+	program.constants.push_back(value);
+	constant_values[bits] = values.size() - 1;
+	return values.size() - 1;
+}
+
+// Instructions that were already emitted with the same operands are reused, across all the outputs
+// Operands of additions and products are ordered first, so a + b and b + a are the same instruction
+size_t Compiler::instruction(CompiledEquation::Opcode op, size_t a, size_t b){
+	if((op == CompiledEquation::OP_ADD || op == CompiledEquation::OP_MULT) && b < a){
+		std::swap(a, b);
+	}
+	std::vector<size_t> key {(size_t)op, a, b};
+	std::unordered_map<std::vector<size_t>, size_t, InstructionKeyHash>::iterator found = numbered_instructions.find(key);
+	if(found != numbered_instructions.end()){
+		return found->second;
+	}
+
+	instructions.push_back(CompiledEquation::Instruction{op, a, b, 0, 0});
+	values.push_back(CompiledValue{CompiledValue::INSTRUCTION, instructions.size() - 1, values[a].varying || values[b].varying});
+	instruction_values.push_back(values.size() - 1);
+	numbered_instructions[key] = values.size() - 1;
+	return values.size() - 1;
+}
+
+// Unary instructions read a twice, so b never refers to a value of the other program
+size_t Compiler::instruction(CompiledEquation::Opcode op, size_t a){
+	return instruction(op, a, a);
+}
+
+size_t Compiler::fold(CompiledEquation::Opcode op, const EquationBase* eq){
+	size_t result = compile(eq->_child(0));
+	for(size_t i = 1; i < eq->_children_count(); i++){
+		result = instruction(op, result, compile(eq->_child(i)));
+	}
+	return result;
+}
+
+
+
+// Shared nodes and nodes equal to an already compiled one are only compiled once
+// Numbers go straight to the constant table, since node equality doesn't tell 0.0 from -0.0
+size_t Compiler::compile(const EquationBase* eq){
+	if(eq->type == "val" || eq->type == "const"){
+		return constant(dynamic_cast<const EquationValue*>(eq)->value);
+	}
+
+	std::unordered_map<const EquationBase*, size_t, StructuralHash, StructuralEqual>::iterator found = compiled_nodes.find(eq);
+	if(found != compiled_nodes.end()){
+		return found->second;
+	}
+
+	size_t value;
+
+	// Sums of monomials of degree 2 or more are evaluated with Horner's scheme instead of a pow() per term,
+	// other polynomial subtrees are compiled as written
+	PolynomialBound bound {-1, 0};
+	if((eq->type == "sum" || eq->type == "mult" || eq->type == "div" || eq->type == "pow") && is_sum_of_monomials(eq)){
+		bound = polynomial_bound(eq);
+	}
+	Polynomial poly;
+	if(bound.degree >= 2 && bound.degree <= (int)CompiledEquation::MAX_POLYNOMIAL_DEGREE && bound.terms <= CompiledEquation::MAX_POLYNOMIAL_TERMS && Polynomial::from_equation_base(eq, poly) && poly.size() <= CompiledEquation::MAX_POLYNOMIAL_TERMS){
+		value = compile_polynomial(poly);
+	}else{
+		value = compile_node(eq);
+	}
+
+	compiled_nodes[eq] = value;
+	return value;
+}
+
+
+size_t Compiler::compile_node(const EquationBase* eq){
+	if(eq->type == "var"){
+		return input(dynamic_cast<const Variable*>(eq)->name);
+	}else if(eq->type == "val" || eq->type == "const"){
+		return constant(dynamic_cast<const EquationValue*>(eq)->value);
+	}else if(eq->type == "sum"){
+		return fold(CompiledEquation::OP_ADD, eq);
+	}else if(eq->type == "mult"){
+		return fold(CompiledEquation::OP_MULT, eq);
+	}else if(eq->type == "neg"){
+		return instruction(CompiledEquation::OP_NEG, compile(eq->_child(0)));
+	}else if(eq->type == "div"){
+		return instruction(CompiledEquation::OP_DIV, compile(eq->_child(0)), compile(eq->_child(1)));
+	}else if(eq->type == "pow"){
+		return instruction(CompiledEquation::OP_POW, compile(eq->_child(0)), compile(eq->_child(1)));
+	}else if(eq->type == "log"){
+		return instruction(CompiledEquation::OP_LOG, compile(eq->_child(0)), compile(eq->_child(1)));
+	}else if(eq->type == "ln"){
+		return instruction(CompiledEquation::OP_LN, compile(eq->_child(0)));
+	}else if(eq->type == "exp"){
+		return instruction(CompiledEquation::OP_EXP, compile(eq->_child(0)));
+	}else if(eq->type == "abs"){
+		return instruction(CompiledEquation::OP_ABS, compile(eq->_child(0)));
+	}else if(eq->type == "sin"){
+		return instruction(CompiledEquation::OP_SIN, compile(eq->_child(0)));
+	}else if(eq->type == "cos"){
+		return instruction(CompiledEquation::OP_COS, compile(eq->_child(0)));
+	}else if(eq->type == "lazy_derivative"){
+		return compile(eq->_child(0));
+	}
+	throw std::runtime_error("Can't compile an expression of type " + eq->type);
+}
+
+
+// Bounds are clamped just above the limits, so they can't overflow on deeply nested products and powers
+PolynomialBound Compiler::polynomial_bound(const EquationBase* eq){
+	std::unordered_map<const EquationBase*, PolynomialBound>::iterator found = polynomial_bounds.find(eq);
+	if(found != polynomial_bounds.end()){
+		return found->second;
+	}
+
+	const int max_degree = CompiledEquation::MAX_POLYNOMIAL_DEGREE + 1;
+	const size_t max_terms = CompiledEquation::MAX_POLYNOMIAL_TERMS + 1;
+	PolynomialBound bound {-1, 0};
+
+	if(eq->type == "var"){
+		bound = PolynomialBound{1, 1};
+	}else if(eq->type == "val" || eq->type == "const"){
+		bound = PolynomialBound{0, 1};
+	}else if(eq->type == "sum" || eq->type == "mult"){
+		bound = PolynomialBound{0, eq->type == "sum" ? (size_t)0 : (size_t)1};
+		for(size_t i = 0; i < eq->_children_count(); i++){
+			PolynomialBound child = polynomial_bound(eq->_child(i));
+			if(child.degree < 0){
+				bound = PolynomialBound{-1, 0};
+				break;
+			}
+			if(eq->type == "sum"){
+				bound.degree = std::max(bound.degree, child.degree);
+				bound.terms = std::min(bound.terms + child.terms, max_terms);
+			}else{
+				bound.degree = std::min(bound.degree + child.degree, max_degree);
+				bound.terms = std::min(bound.terms * child.terms, max_terms);
+			}
+		}
+	}else if(eq->type == "neg"){
+		bound = polynomial_bound(eq->_child(0));
+	}else if(eq->type == "div"){
+		if(polynomial_bound(eq->_child(1)).degree == 0){
+			bound = polynomial_bound(eq->_child(0));
+		}
+	}else if(eq->type == "pow" && eq->_child(1)->type == "val"){
+		SYMCALC_VALUE_TYPE power = dynamic_cast<const EquationValue*>(eq->_child(1))->value;
+		PolynomialBound base = polynomial_bound(eq->_child(0));
+		if(base.degree >= 0 && power >= 0 && power == std::floor(power) && power <= CompiledEquation::MAX_POLYNOMIAL_DEGREE){
+			bound = PolynomialBound{std::min(base.degree * (int)power, max_degree), 1};
+			for(int i = 0; i < (int)power && bound.terms < max_terms; i++){
+				bound.terms = std::min(bound.terms * base.terms, max_terms);
+			}
+		}
+	}
+
+	polynomial_bounds[eq] = bound;
+	return bound;
+}
+
+
+// Emits Horner's scheme in the variable with the highest degree,
+// the coefficients are polynomials in the other variables and are emitted the same way
+size_t Compiler::compile_polynomial(const Polynomial& poly){
+	if(poly.is_constant()){
+		return constant(poly.constant_value());
+	}
+
+	size_t main_variable = 0;
+	unsigned int main_degree = 0;
+	for(size_t i = 0; i < poly.variables.size(); i++){
+		unsigned int degree = poly.degree(poly.variables[i]);
+		if(degree > main_degree){
+			main_degree = degree;
+			main_variable = i;
+		}
+	}
+
+	std::vector<Polynomial> coefficients (main_degree + 1);
+	for(Polynomial& coefficient : coefficients){
+		coefficient.variables = poly.variables;
+	}
+	for(const std::pair<const Polynomial::Monomial, SYMCALC_VALUE_TYPE>& term : poly.terms){
+		Polynomial::Monomial monomial = term.first;
+		unsigned int power = monomial[main_variable];
+		monomial[main_variable] = 0;
+		coefficients[power].terms[monomial] += term.second;
+	}
+
+	// A coefficient that is a single variable, like a in a * x^2, is read directly from its input
+	std::vector<size_t> coefficient_values;
+	coefficient_values.reserve(coefficients.size());
+	for(const Polynomial& coefficient : coefficients){
+		coefficient_values.push_back(compile_polynomial(coefficient));
+	}
+
+	size_t x = input(poly.variables[main_variable]);
+
+	std::vector<size_t> key {(size_t)CompiledEquation::OP_HORNER, x};
+	key.insert(key.end(), coefficient_values.begin(), coefficient_values.end());
+	std::unordered_map<std::vector<size_t>, size_t, InstructionKeyHash>::iterator found = numbered_instructions.find(key);
+	if(found != numbered_instructions.end()){
+		return found->second;
+	}
+
+	bool varying = values[x].varying;
+	for(size_t coefficient : coefficient_values){
+		varying = varying || values[coefficient].varying;
+	}
+
+	CompiledEquation::Instruction horner {CompiledEquation::OP_HORNER, x, x, program.operands.size(), coefficient_values.size()};
+	program.operands.insert(program.operands.end(), coefficient_values.begin(), coefficient_values.end());
+	instructions.push_back(horner);
+	values.push_back(CompiledValue{CompiledValue::INSTRUCTION, instructions.size() - 1, varying});
+	instruction_values.push_back(values.size() - 1);
+	numbered_instructions[key] = values.size() - 1;
+	return values.size() - 1;
+}
+
+
+// Turns value numbers into registers of the two programs
+// The parameter program gets every value that doesn't depend on the inputs,
+// the evaluation program copies the ones it reads into its invariants block
+void Compiler::finish(const std::vector<size_t>& outputs){
+	size_t inputs_count = program.variables.size();
+	size_t parameters_count = program.parameters.size();
+	size_t constants_count = program.constants.size();
+	const size_t unassigned = (size_t)-1;
+
+	std::vector<size_t> parameter_registers (values.size(), unassigned);
+	std::vector<size_t> registers (values.size(), unassigned);
+
+	for(size_t i = 0; i < values.size(); i++){
+		switch(values[i].kind){
+			case CompiledValue::INPUT: registers[i] = values[i].index; break;
+			case CompiledValue::PARAMETER: parameter_registers[i] = values[i].index; break;
+			case CompiledValue::CONSTANT: parameter_registers[i] = parameters_count + values[i].index; break;
+			case CompiledValue::INSTRUCTION: break;
+		}
+	}
+
+	std::vector<size_t> evaluated_values;
+	for(size_t i = 0; i < instructions.size(); i++){
+		size_t value = instruction_values[i];
+		if(values[value].varying){
+			evaluated_values.push_back(value);
+		}else{
+			parameter_registers[value] = parameters_count + constants_count + program.parameter_instructions.size();
+			program.parameter_instructions.push_back(instructions[i]);
+			remap(program.parameter_instructions.back(), parameter_registers);
+		}
+	}
+
+	// Invariants are numbered in the order the evaluation program first reads them
+	std::vector<size_t> read_values;
+	for(size_t value : evaluated_values){
+		const CompiledEquation::Instruction& instruction = instructions[values[value].index];
+		read_values.push_back(instruction.a);
+		read_values.push_back(instruction.b);
+		read_values.insert(read_values.end(), program.operands.begin() + instruction.begin, program.operands.begin() + instruction.begin + instruction.count);
+	}
+	read_values.insert(read_values.end(), outputs.begin(), outputs.end());
+
+	for(size_t value : read_values){
+		if(!values[value].varying && registers[value] == unassigned){
+			registers[value] = inputs_count + program.invariant_sources.size();
+			program.invariant_sources.push_back(parameter_registers[value]);
+		}
+	}
+
+	size_t results_begin = inputs_count + program.invariant_sources.size();
+	for(size_t i = 0; i < evaluated_values.size(); i++){
+		registers[evaluated_values[i]] = results_begin + i;
+		program.instructions.push_back(instructions[values[evaluated_values[i]].index]);
+		remap(program.instructions.back(), registers);
+	}
+
+	for(size_t output : outputs){
+		program.outputs.push_back(registers[output]);
+	}
+}
+
+// Each instruction has its own range of operands, so they can be rewritten in place
+void Compiler::remap(CompiledEquation::Instruction& instruction, const std::vector<size_t>& registers){
+	instruction.a = registers[instruction.a];
+	instruction.b = registers[instruction.b];
+	for(size_t i = instruction.begin; i < instruction.begin + instruction.count; i++){
+		program.operands[i] = registers[program.operands[i]];
+	}
+}
+
+} // End of anonymous namespace
+
+
+
+static std::vector<SYMCALC_VAR_NAME_TYPE> variable_names(const std::vector<Equation>& variables){
+	std::vector<SYMCALC_VAR_NAME_TYPE> names;
+	for(const Equation& variable : variables){
+		EquationBase* var_eq = variable.copy_eq();
+		Variable* var = dynamic_cast<Variable*>(var_eq);
+		if(!var){
+			delete_equation_base(var_eq);
+			throw std::runtime_error("Provided variable is not of Variable type");
+		}
+		names.push_back(var->name);
+		delete_equation_base(var_eq);
+	}
+	return names;
+}
+
+
+CompiledEquation compile(const std::vector<Equation>& equations, const std::vector<Equation>& variables, const std::vector<Equation>& parameters){
+	return CompiledEquation(equations, variables, parameters);
+}
+
+
+CompiledEquation::CompiledEquation(const Equation& equation, const std::vector<Equation>& variables, const std::vector<Equation>& parameters) : CompiledEquation(std::vector<Equation>{equation}, variables, parameters) {}
+
+CompiledEquation::CompiledEquation(const std::vector<Equation>& equations, const std::vector<Equation>& variables, const std::vector<Equation>& parameters){
+	this->variables = variable_names(variables);
+	this->parameters = variable_names(parameters);
+	for(const SYMCALC_VAR_NAME_TYPE& name : this->parameters){
+		if(std::find(this->variables.begin(), this->variables.end(), name) != this->variables.end()){
+			throw std::runtime_error("Variable " + name + " can't be both an input and a parameter");
+		}
+	}
+
+	if(equations.empty()){
+		throw std::runtime_error("CompiledEquation expects at least one equation");
+	}
+	std::vector<EquationBase*> eqs;
+	for(const Equation& equation : equations){
+		eqs.push_back(equation.copy_eq());
+	}
+	try{
+		Compiler compiler (*this);
+		std::vector<size_t> output_values;
+		for(const EquationBase* eq : eqs){
+			output_values.push_back(compiler.compile(eq));
+		}
+		compiler.finish(output_values);
+	}catch(...){
+		for(EquationBase* eq : eqs){
+			delete_equation_base(eq);
+		}
+		throw;
+	}
+	for(EquationBase* eq : eqs){
+		delete_equation_base(eq);
+	}
+
+	parameter_registers.resize(this->parameters.size() + constants.size() + parameter_instructions.size());
+	std::copy(constants.begin(), constants.end(), parameter_registers.begin() + this->parameters.size());
+	invariants.resize(invariant_sources.size());
+	set_parameters(std::vector<SYMCALC_VALUE_TYPE>(this->parameters.size(), 0));
+}
+
+
+void CompiledEquation::set_parameters(const SYMCALC_VALUE_TYPE* values){
+	std::copy(values, values + parameters.size(), parameter_registers.begin());
+	_run(parameter_instructions, parameter_registers.data(), parameter_registers.data() + parameters.size() + constants.size(), false);
+	for(size_t i = 0; i < invariants.size(); i++){
+		invariants[i] = parameter_registers[invariant_sources[i]];
+	}
+}
+
+void CompiledEquation::set_parameters(const std::vector<SYMCALC_VALUE_TYPE>& values){
+	if(values.size() != parameters.size()){
+		throw std::runtime_error("CompiledEquation.set_parameters expects one value per parameter");
+	}
+	set_parameters(values.data());
+}
+
+
+
+//
+// Evaluation
+//
+
+size_t CompiledEquation::workspace_size() const{
+	return variables.size() + invariants.size() + instructions.size();
+}
+
+
+// Horner's scheme, one multiply-add per coefficient but each depends on the previous one
+static inline SYMCALC_VALUE_TYPE horner(SYMCALC_VALUE_TYPE x, const size_t* coefficients, size_t count, const SYMCALC_VALUE_TYPE* registers){
+	SYMCALC_VALUE_TYPE result = registers[coefficients[count - 1]];
+	for(size_t i = count - 1; i > 0; i--){
+		result = result * x + registers[coefficients[i - 1]];
+	}
+	return result;
+}
+
+// Estrin's scheme, pairs of coefficients are combined independently with x, x^2, x^4, ...
+// so the multiplications of each level can run in parallel
+static inline SYMCALC_VALUE_TYPE estrin(SYMCALC_VALUE_TYPE x, const size_t* coefficients, size_t count, const SYMCALC_VALUE_TYPE* registers){
+	SYMCALC_VALUE_TYPE partial[CompiledEquation::MAX_POLYNOMIAL_DEGREE + 1];
+
+	for(size_t i = 0; i < count; i++){
+		partial[i] = registers[coefficients[i]];
+	}
+
+	while(count > 1){
+		size_t half = count / 2;
+		for(size_t i = 0; i < half; i++){
+			partial[i] = partial[2 * i] + partial[2 * i + 1] * x;
+		}
+		if(count % 2 == 1){
+			partial[half] = partial[count - 1];
+			half++;
+		}
+		count = half;
+		x = x * x;
+	}
+
+	return partial[0];
+}
+
+
+SYMCALC_VALUE_TYPE CompiledEquation::_run_instruction(const Instruction& instruction, const SYMCALC_VALUE_TYPE* registers, bool use_estrin) const{
+	SYMCALC_VALUE_TYPE a = registers[instruction.a];
+	SYMCALC_VALUE_TYPE b = registers[instruction.b];
+
+	switch(instruction.op){
+		case OP_ADD: return a + b;
+		case OP_NEG: return -a;
+		case OP_MULT: return a * b;
+		case OP_DIV: return a / b;
+		case OP_POW: return std::pow(a, b);
+		case OP_LOG: return std::log(a) / std::log(b);
+		case OP_LN: return std::log(a);
+		case OP_EXP: return std::exp(a);
+		case OP_ABS: return a < 0 ? -a : a;
+		case OP_SIN: return std::sin(a);
+		case OP_COS: return std::cos(a);
+		case OP_HORNER:
+			if(use_estrin){
+				return estrin(a, &operands[instruction.begin], instruction.count, registers);
+			}
+			return horner(a, &operands[instruction.begin], instruction.count, registers);
+	}
+	return 0;
+}
+
+void CompiledEquation::_run(const std::vector<Instruction>& program, SYMCALC_VALUE_TYPE* registers, SYMCALC_VALUE_TYPE* result, bool use_estrin) const{
+	for(const Instruction& instruction : program){
+		*result = _run_instruction(instruction, registers, use_estrin);
+		result++;
+	}
+}
+
+
+SYMCALC_VALUE_TYPE CompiledEquation::eval(const SYMCALC_VALUE_TYPE* inputs, SYMCALC_VALUE_TYPE* workspace) const{
+	std::copy(inputs, inputs + variables.size(), workspace);
+	std::copy(invariants.begin(), invariants.end(), workspace + variables.size());
+	_run(instructions, workspace, workspace + variables.size() + invariants.size(), false);
+	return workspace[outputs[0]];
+}
+
+SYMCALC_VALUE_TYPE CompiledEquation::eval(const std::vector<SYMCALC_VALUE_TYPE>& inputs) const{
+	if(inputs.size() != variables.size()){
+		throw std::runtime_error("CompiledEquation.eval expects one value per variable");
+	}
+	std::vector<SYMCALC_VALUE_TYPE> workspace (workspace_size());
+	return eval(inputs.data(), workspace.data());
+}
+
+SYMCALC_VALUE_TYPE CompiledEquation::operator()(const std::vector<SYMCALC_VALUE_TYPE>& inputs) const{
+	return eval(inputs);
+}
+
+
+void CompiledEquation::eval_all(const SYMCALC_VALUE_TYPE* inputs, SYMCALC_VALUE_TYPE* results, SYMCALC_VALUE_TYPE* workspace) const{
+	eval(inputs, workspace);
+	for(size_t i = 0; i < outputs.size(); i++){
+		results[i] = workspace[outputs[i]];
+	}
+}
+
+std::vector<SYMCALC_VALUE_TYPE> CompiledEquation::eval_all(const std::vector<SYMCALC_VALUE_TYPE>& inputs) const{
+	if(inputs.size() != variables.size()){
+		throw std::runtime_error("CompiledEquation.eval_all expects one value per variable");
+	}
+	std::vector<SYMCALC_VALUE_TYPE> workspace (workspace_size());
+	std::vector<SYMCALC_VALUE_TYPE> results (outputs.size());
+	eval_all(inputs.data(), results.data(), workspace.data());
+	return results;
+}
+
+
+// Rows of inputs are stored one after another, polynomials use Estrin's scheme here
+void CompiledEquation::eval_batch(const SYMCALC_VALUE_TYPE* inputs, size_t rows, SYMCALC_VALUE_TYPE* results) const{
+	std::vector<SYMCALC_VALUE_TYPE> workspace (workspace_size());
+	std::copy(invariants.begin(), invariants.end(), workspace.begin() + variables.size());
+	SYMCALC_VALUE_TYPE* results_begin = workspace.data() + variables.size() + invariants.size();
+
+	for(size_t row = 0; row < rows; row++){
+		std::copy(inputs + row * variables.size(), inputs + (row + 1) * variables.size(), workspace.begin());
+		_run(instructions, workspace.data(), results_begin, true);
+		for(size_t i = 0; i < outputs.size(); i++){
+			results[row * outputs.size() + i] = workspace[outputs[i]];
+		}
+	}
+}
+
+
+
+
+//
+// Reverse-mode gradient and forward-mode tangents
+//
+
+size_t CompiledEquation::gradient_workspace_size() const{
+	return 2 * workspace_size();
+}
+
+
+// Walks the instructions backwards, adding the adjoint of each result times the partial derivatives to its operands
+// Invariants get adjoints too, they are just never read
+void CompiledEquation::_run_adjoints(const SYMCALC_VALUE_TYPE* registers, SYMCALC_VALUE_TYPE* adjoints) const{
+	size_t result = variables.size() + invariants.size() + instructions.size();
+
+	for(std::vector<Instruction>::const_reverse_iterator it = instructions.rbegin(); it != instructions.rend(); it++){
+		const Instruction& instruction = *it;
+		result--;
+
+		SYMCALC_VALUE_TYPE adjoint = adjoints[result];
+		if(adjoint == 0){
+			continue;
+		}
+
+		SYMCALC_VALUE_TYPE a = registers[instruction.a];
+		SYMCALC_VALUE_TYPE b = registers[instruction.b];
+		SYMCALC_VALUE_TYPE value = registers[result];
+
+		switch(instruction.op){
+			case OP_ADD:
+				adjoints[instruction.a] += adjoint;
+				adjoints[instruction.b] += adjoint;
+				break;
+			case OP_NEG: adjoints[instruction.a] -= adjoint; break;
+			case OP_MULT:
+				adjoints[instruction.a] += adjoint * b;
+				adjoints[instruction.b] += adjoint * a;
+				break;
+			case OP_DIV:
+				adjoints[instruction.a] += adjoint / b;
+				adjoints[instruction.b] -= adjoint * value / b;
+				break;
+			case OP_POW:
+				adjoints[instruction.a] += adjoint * b * std::pow(a, b - 1);
+				if(a > 0){ // a ^ b only has a derivative in b for positive a
+					adjoints[instruction.b] += adjoint * value * std::log(a);
+				}
+				break;
+			case OP_LOG:
+				adjoints[instruction.a] += adjoint / (a * std::log(b));
+				adjoints[instruction.b] -= adjoint * value / (b * std::log(b));
+				break;
+			case OP_LN: adjoints[instruction.a] += adjoint / a; break;
+			case OP_EXP: adjoints[instruction.a] += adjoint * value; break;
+			case OP_ABS: adjoints[instruction.a] += a < 0 ? -adjoint : (a > 0 ? adjoint : 0); break;
+			case OP_SIN: adjoints[instruction.a] += adjoint * std::cos(a); break;
+			case OP_COS: adjoints[instruction.a] -= adjoint * std::sin(a); break;
+			case OP_HORNER: {
+				// p(x) = sum of c_k * x^k, so dp/dc_k = x^k and dp/dx is the derivative polynomial, evaluated with Horner's scheme
+				const size_t* coefficients = &operands[instruction.begin];
+				SYMCALC_VALUE_TYPE derivative = 0;
+				for(size_t k = instruction.count - 1; k > 0; k--){
+					derivative = derivative * a + k * registers[coefficients[k]];
+				}
+				adjoints[instruction.a] += adjoint * derivative;
+
+				SYMCALC_VALUE_TYPE power = 1;
+				for(size_t k = 0; k < instruction.count; k++){
+					adjoints[coefficients[k]] += adjoint * power;
+					power *= a;
+				}
+				break;
+			}
+		}
+	}
+}
+
+
+// Walks the instructions forwards, the tangent of each result is the partial derivatives times the tangents of its operands
+// Invariants don't depend on the inputs, so their tangents stay zero
+// Zero tangents are skipped, so a partial derivative that isn't defined at this point doesn't turn the result into NaN
+void CompiledEquation::_run_tangents(const SYMCALC_VALUE_TYPE* registers, SYMCALC_VALUE_TYPE* tangents) const{
+	size_t result = variables.size() + invariants.size();
+
+	for(const Instruction& instruction : instructions){
+		SYMCALC_VALUE_TYPE a = registers[instruction.a];
+		SYMCALC_VALUE_TYPE b = registers[instruction.b];
+		SYMCALC_VALUE_TYPE value = registers[result];
+		SYMCALC_VALUE_TYPE ta = tangents[instruction.a];
+		SYMCALC_VALUE_TYPE tb = tangents[instruction.b];
+		SYMCALC_VALUE_TYPE tangent = 0;
+
+		switch(instruction.op){
+			case OP_ADD: tangent = ta + tb; break;
+			case OP_NEG: tangent = -ta; break;
+			case OP_MULT:
+				if(ta != 0) tangent += ta * b;
+				if(tb != 0) tangent += a * tb;
+				break;
+			case OP_DIV:
+				if(ta != 0) tangent += ta / b;
+				if(tb != 0) tangent -= tb * value / b;
+				break;
+			case OP_POW:
+				if(ta != 0) tangent += ta * b * std::pow(a, b - 1);
+				if(tb != 0 && a > 0) tangent += tb * value * std::log(a);
+				break;
+			case OP_LOG:
+				if(ta != 0) tangent += ta / (a * std::log(b));
+				if(tb != 0) tangent -= tb * value / (b * std::log(b));
+				break;
+			case OP_LN: if(ta != 0) tangent = ta / a; break;
+			case OP_EXP: if(ta != 0) tangent = ta * value; break;
+			case OP_ABS: tangent = a < 0 ? -ta : (a > 0 ? ta : 0); break;
+			case OP_SIN: if(ta != 0) tangent = ta * std::cos(a); break;
+			case OP_COS: if(ta != 0) tangent = -ta * std::sin(a); break;
+			case OP_HORNER: {
+				const size_t* coefficients = &operands[instruction.begin];
+				if(ta != 0){
+					SYMCALC_VALUE_TYPE derivative = 0;
+					for(size_t k = instruction.count - 1; k > 0; k--){
+						derivative = derivative * a + k * registers[coefficients[k]];
+					}
+					tangent += ta * derivative;
+				}
+				SYMCALC_VALUE_TYPE power = 1;
+				for(size_t k = 0; k < instruction.count; k++){
+					tangent += tangents[coefficients[k]] * power;
+					power *= a;
+				}
+				break;
+			}
+		}
+
+		tangents[result] = tangent;
+		result++;
+	}
+}
+
+
+void CompiledEquation::jacobian_vector_product(const SYMCALC_VALUE_TYPE* inputs, const SYMCALC_VALUE_TYPE* direction, SYMCALC_VALUE_TYPE* results, SYMCALC_VALUE_TYPE* workspace) const{
+	size_t registers_count = workspace_size();
+	SYMCALC_VALUE_TYPE* tangents = workspace + registers_count;
+
+	eval(inputs, workspace);
+
+	std::copy(direction, direction + variables.size(), tangents);
+	std::fill(tangents + variables.size(), tangents + registers_count, 0);
+	_run_tangents(workspace, tangents);
+
+	for(size_t i = 0; i < outputs.size(); i++){
+		results[i] = tangents[outputs[i]];
+	}
+}
+
+std::vector<SYMCALC_VALUE_TYPE> CompiledEquation::jacobian_vector_product(const std::vector<SYMCALC_VALUE_TYPE>& inputs, const std::vector<SYMCALC_VALUE_TYPE>& direction) const{
+	if(inputs.size() != variables.size() || direction.size() != variables.size()){
+		throw std::runtime_error("CompiledEquation.jacobian_vector_product expects one value and one direction component per variable");
+	}
+	std::vector<SYMCALC_VALUE_TYPE> workspace (gradient_workspace_size());
+	std::vector<SYMCALC_VALUE_TYPE> results (outputs.size());
+	jacobian_vector_product(inputs.data(), direction.data(), results.data(), workspace.data());
+	return results;
+}
+
+
+SYMCALC_VALUE_TYPE CompiledEquation::value_and_gradient(const SYMCALC_VALUE_TYPE* inputs, SYMCALC_VALUE_TYPE* gradient, SYMCALC_VALUE_TYPE* workspace) const{
+	size_t registers_count = workspace_size();
+	SYMCALC_VALUE_TYPE* adjoints = workspace + registers_count;
+
+	SYMCALC_VALUE_TYPE value = eval(inputs, workspace);
+
+	std::fill(adjoints, adjoints + registers_count, 0);
+	adjoints[outputs[0]] = 1;
+	_run_adjoints(workspace, adjoints);
+
+	std::copy(adjoints, adjoints + variables.size(), gradient);
+	return value;
+}
+
+SYMCALC_VALUE_TYPE CompiledEquation::value_and_gradient(const std::vector<SYMCALC_VALUE_TYPE>& inputs, std::vector<SYMCALC_VALUE_TYPE>& gradient) const{
+	if(inputs.size() != variables.size()){
+		throw std::runtime_error("CompiledEquation.value_and_gradient expects one value per variable");
+	}
+	if(outputs.size() != 1){
+		throw std::runtime_error("CompiledEquation.value_and_gradient expects a program with a single output");
+	}
+	gradient.resize(variables.size());
+	std::vector<SYMCALC_VALUE_TYPE> workspace (gradient_workspace_size());
+	return value_and_gradient(inputs.data(), gradient.data(), workspace.data());
+}
+
+
+
+//
+// Hessian-vector products, forward mode over the reverse sweep
+//
+
+size_t CompiledEquation::hessian_vector_workspace_size() const{
+	return 4 * workspace_size();
+}
+
+
+// Reverse sweep that carries the tangent of every adjoint along with the adjoint
+// An operand gets adjoint * d, where d is the partial derivative of the result, so its adjoint tangent gets
+// adjoint_tangent * d + adjoint * (tangent of d), and the tangent of d comes from the second derivatives of the instruction
+void CompiledEquation::_run_adjoint_tangents(const SYMCALC_VALUE_TYPE* registers, const SYMCALC_VALUE_TYPE* tangents, SYMCALC_VALUE_TYPE* adjoints, SYMCALC_VALUE_TYPE* adjoint_tangents) const{
+	size_t result = variables.size() + invariants.size() + instructions.size();
+
+	for(std::vector<Instruction>::const_reverse_iterator it = instructions.rbegin(); it != instructions.rend(); it++){
+		const Instruction& instruction = *it;
+		result--;
+
+		SYMCALC_VALUE_TYPE adjoint = adjoints[result];
+		SYMCALC_VALUE_TYPE adjoint_tangent = adjoint_tangents[result];
+		if(adjoint == 0 && adjoint_tangent == 0){
+			continue;
+		}
+
+		SYMCALC_VALUE_TYPE a = registers[instruction.a];
+		SYMCALC_VALUE_TYPE b = registers[instruction.b];
+		SYMCALC_VALUE_TYPE value = registers[result];
+		SYMCALC_VALUE_TYPE ta = tangents[instruction.a];
+		SYMCALC_VALUE_TYPE tb = tangents[instruction.b];
+		SYMCALC_VALUE_TYPE tangent = tangents[result];
+
+		// Partial derivatives of the result with respect to a and b, and their tangents
+		SYMCALC_VALUE_TYPE da = 0, db = 0, da_tangent = 0, db_tangent = 0;
+
+		switch(instruction.op){
+			case OP_ADD: da = 1; db = 1; break;
+			case OP_NEG: da = -1; break;
+			case OP_MULT:
+				da = b; da_tangent = tb;
+				db = a; db_tangent = ta;
+				break;
+			case OP_DIV:
+				da = 1 / b;
+				db = -value / b;
+				if(tb != 0) da_tangent = -tb / (b * b);
+				db_tangent = -(tangent * b - value * tb) / (b * b);
+				break;
+			case OP_POW: {
+				SYMCALC_VALUE_TYPE power = std::pow(a, b - 1);
+				da = b * power;
+				if(ta != 0) da_tangent += ta * b * (b - 1) * std::pow(a, b - 2);
+				if(tb != 0) da_tangent += tb * power * (a > 0 ? 1 + b * std::log(a) : 1);
+				if(a > 0){ // a ^ b only has a derivative in b for positive a
+					db = value * std::log(a);
+					db_tangent = tangent * std::log(a) + (ta != 0 ? value * ta / a : 0);
+				}
+				break;
+			}
+			case OP_LOG: {
+				SYMCALC_VALUE_TYPE ln_b = std::log(b);
+				da = 1 / (a * ln_b);
+				db = -value / (b * ln_b);
+				if(ta != 0) da_tangent -= ta / (a * a * ln_b);
+				if(tb != 0) da_tangent -= tb / (a * b * ln_b * ln_b);
+				db_tangent = -tangent / (b * ln_b);
+				if(tb != 0) db_tangent += value * tb * (ln_b + 1) / (b * b * ln_b * ln_b);
+				break;
+			}
+			case OP_LN:
+				da = 1 / a;
+				if(ta != 0) da_tangent = -ta / (a * a);
+				break;
+			case OP_EXP: da = value; da_tangent = tangent; break;
+			case OP_ABS: da = a < 0 ? -1 : (a > 0 ? 1 : 0); break;
+			case OP_SIN:
+				da = std::cos(a);
+				if(ta != 0) da_tangent = -std::sin(a) * ta;
+				break;
+			case OP_COS:
+				da = -std::sin(a);
+				if(ta != 0) da_tangent = -std::cos(a) * ta;
+				break;
+			case OP_HORNER: {
+				// dp/dx and its tangent p''(x) * tx + sum of k * c_k' * x^(k - 1), dp/dc_k = x^k with tangent k * x^(k - 1) * tx
+				const size_t* coefficients = &operands[instruction.begin];
+				SYMCALC_VALUE_TYPE second = 0;
+				for(size_t k = instruction.count - 1; k > 1; k--){
+					second = second * a + k * (k - 1) * registers[coefficients[k]];
+				}
+				SYMCALC_VALUE_TYPE power = 1; // a^(k - 1)
+				for(size_t k = 1; k < instruction.count; k++){
+					da += k * registers[coefficients[k]] * power;
+					da_tangent += k * tangents[coefficients[k]] * power;
+					power *= a;
+				}
+				da_tangent += second * ta;
+
+				power = 1;
+				SYMCALC_VALUE_TYPE previous_power = 0; // a^(k - 1), zero for k = 0
+				for(size_t k = 0; k < instruction.count; k++){
+					adjoints[coefficients[k]] += adjoint * power;
+					adjoint_tangents[coefficients[k]] += adjoint_tangent * power + adjoint * k * previous_power * ta;
+					previous_power = power;
+					power *= a;
+				}
+				break;
+			}
+		}
+
+		adjoints[instruction.a] += adjoint * da;
+		adjoint_tangents[instruction.a] += adjoint_tangent * da + adjoint * da_tangent;
+		bool binary = instruction.op == OP_ADD || instruction.op == OP_MULT || instruction.op == OP_DIV || instruction.op == OP_POW || instruction.op == OP_LOG;
+		if(binary){
+			adjoints[instruction.b] += adjoint * db;
+			adjoint_tangents[instruction.b] += adjoint_tangent * db + adjoint * db_tangent;
+		}
+	}
+}
+
+
+void CompiledEquation::hessian_vector_product(const SYMCALC_VALUE_TYPE* inputs, const SYMCALC_VALUE_TYPE* direction, SYMCALC_VALUE_TYPE* product, SYMCALC_VALUE_TYPE* workspace) const{
+	size_t registers_count = workspace_size();
+	SYMCALC_VALUE_TYPE* tangents = workspace + registers_count;
+	SYMCALC_VALUE_TYPE* adjoints = tangents + registers_count;
+	SYMCALC_VALUE_TYPE* adjoint_tangents = adjoints + registers_count;
+
+	eval(inputs, workspace);
+
+	std::copy(direction, direction + variables.size(), tangents);
+	std::fill(tangents + variables.size(), tangents + registers_count, 0);
+	_run_tangents(workspace, tangents);
+
+	std::fill(adjoints, adjoints + 2 * registers_count, 0);
+	adjoints[outputs[0]] = 1;
+	_run_adjoint_tangents(workspace, tangents, adjoints, adjoint_tangents);
+
+	std::copy(adjoint_tangents, adjoint_tangents + variables.size(), product);
+}
+
+std::vector<SYMCALC_VALUE_TYPE> CompiledEquation::hessian_vector_product(const std::vector<SYMCALC_VALUE_TYPE>& inputs, const std::vector<SYMCALC_VALUE_TYPE>& direction) const{
+	if(inputs.size() != variables.size() || direction.size() != variables.size()){
+		throw std::runtime_error("CompiledEquation.hessian_vector_product expects one value and one direction component per variable");
+	}
+	if(outputs.size() != 1){
+		throw std::runtime_error("CompiledEquation.hessian_vector_product expects a program with a single output");
+	}
+	std::vector<SYMCALC_VALUE_TYPE> workspace (hessian_vector_workspace_size());
+	std::vector<SYMCALC_VALUE_TYPE> product (variables.size());
+	hessian_vector_product(inputs.data(), direction.data(), product.data(), workspace.data());
+	return product;
+}
+
+
+} // End of symcalc namespace
@@ -0,0 +1,57 @@
+// Copyright 2024 Kyrylo Shyshko
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symcalc/symcalc.hpp"
+
+//
+// context.cpp:
+// Definitions for Context, the per-thread settings used when building expressions, ContextScope and OperationCancelled
+//
+
+namespace symcalc{
+
+
+Context::Context() : auto_simplify(true), simplify_cache(nullptr), derivative_cache(nullptr), pool(nullptr), parallel_threshold(10000), cancelled(nullptr) {}
+
+
+EquationCache& Context::simplifications() const{
+	return simplify_cache != nullptr ? *simplify_cache : symcalc::simplify_cache();
+}
+
+EquationCache& Context::derivatives() const{
+	return derivative_cache != nullptr ? *derivative_cache : symcalc::derivative_cache();
+}
+
+
+Context& Context::current(){
+	static thread_local Context context;
+	return context;
+}
+
+
+
+OperationCancelled::OperationCancelled() : std::runtime_error("Operation was cancelled") {}
+
+
+
+ContextScope::ContextScope(const Context& context) : previous(Context::current()){
+	Context::current() = context;
+}
+
+ContextScope::~ContextScope(){
+	Context::current() = previous;
+}
+
+
+} // End of symcalc namespace
@@ -0,0 +1,186 @@
+// Copyright 2024 Kyrylo Shyshko
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symcalc/symcalc.hpp"
+#include <stdexcept>
+
+//
+// dual.cpp:
+// Forward-mode evaluation over dual numbers, a value with derivatives along several directions (lanes)
+// Every node follows the same rule as its _derivative(), applied to numbers instead of trees
+//
+
+namespace symcalc{
+
+
+Dual::Dual() : value(0) {}
+
+Dual::Dual(SYMCALC_VALUE_TYPE value, std::vector<SYMCALC_VALUE_TYPE> tangents) : value(value), tangents(tangents) {}
+
+Dual Dual::constant(SYMCALC_VALUE_TYPE value, size_t lanes){
+	return Dual(value, std::vector<SYMCALC_VALUE_TYPE>(lanes, 0));
+}
+
+
+// result.tangents += tangents * factor
+// Zero tangents are skipped, like subtrees that don't depend on the variable in derivative_equation_base(),
+// so a factor that isn't defined at this point doesn't turn them into NaN
+static void add_scaled(Dual& result, const Dual& dual, SYMCALC_VALUE_TYPE factor){
+	for(size_t i = 0; i < result.tangents.size(); i++){
+		if(dual.tangents[i] != 0){
+			result.tangents[i] += dual.tangents[i] * factor;
+		}
+	}
+}
+
+// Derivative of f(g) is f'(g) * g'
+static Dual chain(SYMCALC_VALUE_TYPE value, const Dual& inner, SYMCALC_VALUE_TYPE outer_derivative){
+	Dual result = Dual::constant(value, inner.tangents.size());
+	add_scaled(result, inner, outer_derivative);
+	return result;
+}
+
+static bool is_constant(const Dual& dual){
+	for(SYMCALC_VALUE_TYPE tangent : dual.tangents){
+		if(tangent != 0) return false;
+	}
+	return true;
+}
+
+
+
+Dual EquationBase::eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const{
+	throw std::runtime_error("Forward-mode evaluation isn't supported for expressions of type " + type);
+}
+
+
+// Variables that aren't given are zero, like in eval()
+Dual Variable::eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const{
+	SYMCALC_DUAL_HASH_TYPE::const_iterator found = var_hash.find(name);
+	if(found == var_hash.end()){
+		return Dual::constant(0, lanes);
+	}
+	if(found->second.tangents.size() != lanes){
+		throw std::runtime_error("Dual value of " + name + " doesn't have one tangent per direction");
+	}
+	return found->second;
+}
+
+Dual EquationValue::eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const{
+	return Dual::constant(value, lanes);
+}
+
+
+Dual Sum::eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const{
+	Dual result = Dual::constant(0, lanes);
+	for(const EquationBase* el : elements){
+		Dual el_dual = el->eval_dual(var_hash, lanes);
+		result.value += el_dual.value;
+		add_scaled(result, el_dual, 1);
+	}
+	return result;
+}
+
+Dual Negate::eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const{
+	Dual eq_dual = eq->eval_dual(var_hash, lanes);
+	return chain(-eq_dual.value, eq_dual, -1);
+}
+
+// Product rule applied one factor at a time: (u * v)' = u' * v + u * v'
+Dual Mult::eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const{
+	Dual result = Dual::constant(1, lanes);
+	for(const EquationBase* el : elements){
+		Dual el_dual = el->eval_dual(var_hash, lanes);
+		for(size_t i = 0; i < lanes; i++){
+			result.tangents[i] = result.tangents[i] * el_dual.value + result.value * el_dual.tangents[i];
+		}
+		result.value *= el_dual.value;
+	}
+	return result;
+}
+
+// (f / g)' = f' / g - f * g' / g^2
+Dual Div::eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const{
+	Dual dividend_dual = dividend->eval_dual(var_hash, lanes);
+	Dual divisor_dual = divisor->eval_dual(var_hash, lanes);
+
+	Dual result = chain(dividend_dual.value / divisor_dual.value, dividend_dual, 1 / divisor_dual.value);
+	add_scaled(result, divisor_dual, -dividend_dual.value / (divisor_dual.value * divisor_dual.value));
+	return result;
+}
+
+// Same cases as Power::_derivative(), so a negative base with a constant power still has a derivative
+Dual Power::eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const{
+	Dual base_dual = base->eval_dual(var_hash, lanes);
+	Dual power_dual = power->eval_dual(var_hash, lanes);
+	SYMCALC_VALUE_TYPE value = std::pow(base_dual.value, power_dual.value);
+
+	if(is_constant(power_dual)){
+		// g ^ C: C * g^(C - 1) * g'
+		return chain(value, base_dual, power_dual.value * std::pow(base_dual.value, power_dual.value - 1));
+	}else if(is_constant(base_dual)){
+		// C ^ h: C^h * ln(C) * h'
+		return chain(value, power_dual, value * std::log(base_dual.value));
+	}
+
+	// g ^ h: g^h * (h' * ln(g) + g' * h / g)
+	Dual result = chain(value, power_dual, value * std::log(base_dual.value));
+	add_scaled(result, base_dual, value * power_dual.value / base_dual.value);
+	return result;
+}
+
+// log_b(f)' = f' / (f * ln(b)) - ln(f) * b' / (b * ln(b)^2)
+Dual Log::eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const{
+	Dual eq_dual = eq->eval_dual(var_hash, lanes);
+	Dual base_dual = base->eval_dual(var_hash, lanes);
+	SYMCALC_VALUE_TYPE ln_eq = std::log(eq_dual.value);
+	SYMCALC_VALUE_TYPE ln_base = std::log(base_dual.value);
+
+	Dual result = chain(ln_eq / ln_base, eq_dual, 1 / (eq_dual.value * ln_base));
+	if(!is_constant(base_dual)){
+		add_scaled(result, base_dual, -ln_eq / (base_dual.value * ln_base * ln_base));
+	}
+	return result;
+}
+
+Dual Ln::eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const{
+	Dual eq_dual = eq->eval_dual(var_hash, lanes);
+	return chain(std::log(eq_dual.value), eq_dual, 1 / eq_dual.value);
+}
+
+Dual Exp::eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const{
+	Dual eq_dual = eq->eval_dual(var_hash, lanes);
+	SYMCALC_VALUE_TYPE value = std::exp(eq_dual.value);
+	return chain(value, eq_dual, value);
+}
+
+// |f|' = f / |f| * f', which isn't defined at zero like the symbolic derivative
+Dual Abs::eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const{
+	Dual insides_dual = insides->eval_dual(var_hash, lanes);
+	SYMCALC_VALUE_TYPE value = std::abs(insides_dual.value);
+	return chain(value, insides_dual, insides_dual.value / value);
+}
+
+Dual Sin::eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const{
+	Dual eq_dual = eq->eval_dual(var_hash, lanes);
+	return chain(std::sin(eq_dual.value), eq_dual, std::cos(eq_dual.value));
+}
+
+Dual Cos::eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const{
+	Dual eq_dual = eq->eval_dual(var_hash, lanes);
+	return chain(std::cos(eq_dual.value), eq_dual, -std::sin(eq_dual.value));
+}
+
+
+} // End of symcalc namespace
@@ -35,17 +35,25 @@ Equation::Equation(const Equation& other){
 
 // Move constructor
 Equation::Equation(Equation&& other){
-	this->eq = copy(other.eq);
+	this->eq = other.eq;
+	other.eq = nullptr;
 }
 
 // Move assignment
 Equation& Equation::operator=(Equation &&other){
-	this->eq = copy(other.eq);
+	if(this != &other){
+		delete_equation_base(this->eq);
+		this->eq = other.eq;
+		other.eq = nullptr;
+	}
 	return *this;
 }
 
+// Copy assignment
 Equation& Equation::operator=(const Equation& other){
-	this->eq = copy(other.eq);
+	EquationBase* new_eq = copy(other.eq);
+	delete_equation_base(this->eq);
+	this->eq = new_eq;
 	return *this;
 }
 
@@ -64,8 +72,8 @@ Equation::Equation(EquationBase* make_eq) {
 	if(make_eq == nullptr)
 	throw std::runtime_error("Provided pointer is a nullptr");
 
-	if(SYMCALC_AUTO_SIMPLIFY){
-		eq = make_eq->_simplify();
+	if(Context::current().auto_simplify){
+		eq = simplify_equation_base(make_eq);
 		delete_equation_base(make_eq);
 	}else{
 		eq = make_eq;
@@ -137,9 +145,9 @@ Equation operator-(const Equation eq1){
 	return Equation(new Negate(copy(eq1.eq)));
 }
 
-// Comparison operator for std::map
+// Comparison operator for std::map, variables are ordered by their names
 bool operator<(const Equation holder1, const Equation holder2){
-	return true;
+	return holder1.eq->txt() < holder2.eq->txt();
 }
 
 
@@ -167,15 +175,41 @@ Equation Equation::derivative(Equation variable, size_t order) const{
 	if(!var){
 		throw std::runtime_error("Provided variable is not of Variable type");
 	}
-	EquationBase* deriv = eq;
+	// Every order is simplified before the next one, and the previous order is released
+	bool auto_simplify = Context::current().auto_simplify;
+	EquationBase* deriv = copy(eq);
 	for(size_t i = 0; i < order; i++){
-		deriv = deriv->_derivative(var->name);
+		EquationBase* next = derivative_equation_base(deriv, var->name);
+		delete_equation_base(deriv);
+		if(auto_simplify && i + 1 < order){
+			deriv = simplify_equation_base(next);
+			delete_equation_base(next);
+		}else{
+			deriv = next;
+		}
 	}	
 	
 	return Equation(deriv);
 }
 
 
+// The view is wrapped directly, since simplifying it would build the whole derivative
+Equation Equation::lazy_derivative(Equation variable, size_t order) const{
+	Variable* var = dynamic_cast<Variable*>(variable.eq);
+	if(!var){
+		throw std::runtime_error("Provided variable is not of Variable type");
+	}
+	EquationBase* deriv = copy(eq);
+	for(size_t i = 0; i < order; i++){
+		deriv = new LazyDerivative(deriv, var->name);
+	}
+	Equation result (0.0);
+	delete_equation_base(result.eq);
+	result.eq = deriv;
+	return result;
+}
+
+
 Equation Equation::derivative(size_t order) const{
 	std::vector<Equation> vars = this->list_variables();
 	if(vars.size() == 1){
@@ -190,14 +224,14 @@ Equation Equation::derivative(size_t order) const{
 
 // Evaluation functions
 
-SYMCALC_VALUE_TYPE Equation::eval(SYMCALC_VAR_HASH_TYPE var_hash) const{
+SYMCALC_VALUE_TYPE Equation::eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
 	return eq->eval(var_hash);
 }
 
 
-SYMCALC_VALUE_TYPE Equation::eval(std::map<Equation, SYMCALC_VALUE_TYPE> var_hash) const{
+SYMCALC_VALUE_TYPE Equation::eval(const std::map<Equation, SYMCALC_VALUE_TYPE>& var_hash) const{
 	SYMCALC_VAR_HASH_TYPE new_var_hash;
-	for(std::pair<Equation, SYMCALC_VALUE_TYPE> mypair: var_hash){
+	for(const std::pair<const Equation, SYMCALC_VALUE_TYPE>& mypair: var_hash){
 		Variable* var = dynamic_cast<Variable*>(mypair.first.eq);
 		if(!var){
 			throw std::runtime_error("Provided variable is not of Variable type");
@@ -211,10 +245,10 @@ SYMCALC_VALUE_TYPE Equation::eval() const{
 	return this->eval(SYMCALC_VAR_HASH_TYPE());
 }
 
-SYMCALC_VALUE_TYPE Equation::operator()(SYMCALC_VAR_HASH_TYPE var_hash) const{
+SYMCALC_VALUE_TYPE Equation::operator()(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
 	return eval(var_hash);
 }
-SYMCALC_VALUE_TYPE Equation::operator()(std::map<Equation, SYMCALC_VALUE_TYPE> var_hash) const{
+SYMCALC_VALUE_TYPE Equation::operator()(const std::map<Equation, SYMCALC_VALUE_TYPE>& var_hash) const{
 	return eval(var_hash);
 }
 SYMCALC_VALUE_TYPE Equation::operator()() const{
@@ -222,10 +256,140 @@ SYMCALC_VALUE_TYPE Equation::operator()() const{
 }
 
 
+// Forward-mode evaluation
+
+Dual Equation::eval_dual(std::map<Equation, Dual> var_hash) const{
+	SYMCALC_DUAL_HASH_TYPE new_var_hash;
+	size_t lanes = var_hash.empty() ? 0 : var_hash.begin()->second.tangents.size();
+	for(const std::pair<const Equation, Dual>& mypair : var_hash){
+		Variable* var = dynamic_cast<Variable*>(mypair.first.eq);
+		if(!var){
+			throw std::runtime_error("Provided variable is not of Variable type");
+		}
+		new_var_hash[var->name] = mypair.second;
+	}
+	return eq->eval_dual(new_var_hash, lanes);
+}
+
+Dual Equation::eval_dual(SYMCALC_VAR_HASH_TYPE var_hash, std::vector<SYMCALC_VAR_HASH_TYPE> directions) const{
+	SYMCALC_DUAL_HASH_TYPE dual_hash;
+	for(const std::pair<const SYMCALC_VAR_NAME_TYPE, SYMCALC_VALUE_TYPE>& value : var_hash){
+		dual_hash[value.first] = Dual::constant(value.second, directions.size());
+	}
+	for(size_t i = 0; i < directions.size(); i++){
+		for(const std::pair<const SYMCALC_VAR_NAME_TYPE, SYMCALC_VALUE_TYPE>& component : directions[i]){
+			SYMCALC_DUAL_HASH_TYPE::iterator found = dual_hash.find(component.first);
+			if(found == dual_hash.end()){
+				found = dual_hash.insert(std::make_pair(component.first, Dual::constant(0, directions.size()))).first;
+			}
+			found->second.tangents[i] = component.second;
+		}
+	}
+	return eq->eval_dual(dual_hash, directions.size());
+}
+
+
+// Taylor-mode evaluation
+
+TaylorSeries Equation::taylor_coefficients(Equation variable, SYMCALC_VALUE_TYPE point, size_t order, SYMCALC_VAR_HASH_TYPE values) const{
+	Variable* var = dynamic_cast<Variable*>(variable.eq);
+	if(!var){
+		throw std::runtime_error("Provided variable is not of Variable type");
+	}
+	values[var->name] = point;
+	return eq->eval_taylor(values, var->name, order);
+}
+
+std::vector<SYMCALC_VALUE_TYPE> Equation::derivatives_at(Equation variable, SYMCALC_VALUE_TYPE point, size_t order, SYMCALC_VAR_HASH_TYPE values) const{
+	TaylorSeries derivatives = taylor_coefficients(variable, point, order, values);
+	SYMCALC_VALUE_TYPE factorial = 1;
+	for(size_t k = 1; k <= order; k++){
+		factorial *= k;
+		derivatives[k] *= factorial;
+	}
+	return derivatives;
+}
+
+// Terms with a zero coefficient are left out
+Equation Equation::taylor(Equation variable, SYMCALC_VALUE_TYPE point, size_t order, SYMCALC_VAR_HASH_TYPE values) const{
+	TaylorSeries coefficients = taylor_coefficients(variable, point, order, values);
+	Equation shifted = point == 0 ? variable : variable - Equation(point);
+	std::vector<EquationBase*> terms;
+	for(size_t k = 0; k <= order; k++){
+		if(coefficients[k] == 0){
+			continue;
+		}
+		if(k == 0){
+			terms.push_back(new EquationValue(coefficients[k]));
+		}else if(k == 1){
+			terms.push_back(new Mult({new EquationValue(coefficients[k]), shifted.copy_eq()}));
+		}else{
+			terms.push_back(new Mult({new EquationValue(coefficients[k]), new Power(shifted.copy_eq(), new EquationValue(k))}));
+		}
+	}
+	if(terms.empty()){
+		return Equation(0.0);
+	}
+	return Equation(terms.size() == 1 ? terms[0] : new Sum(terms));
+}
+
+
 // Simplification
 
 Equation Equation::simplify() const{
-	return Equation(eq->_simplify());
+	return Equation(simplify_equation_base(eq));
+}
+
+
+
+
+// Expansion of polynomial subtrees
+
+Equation Equation::expand() const{
+	return Equation(expand_equation_base(eq));
+}
+
+
+
+
+// Substitution
+
+Equation Equation::substitute(std::map<Equation, Equation> replacements) const{
+	std::map<SYMCALC_VAR_NAME_TYPE, const EquationBase*> named_replacements;
+	for(const std::pair<const Equation, Equation>& replacement : replacements){
+		Variable* var = dynamic_cast<Variable*>(replacement.first.eq);
+		if(!var){
+			throw std::runtime_error("Provided variable is not of Variable type");
+		}
+		named_replacements[var->name] = replacement.second.eq;
+	}
+	return Equation(substitute_equation_base(eq, named_replacements));
+}
+
+Equation Equation::specialize(std::map<Equation, SYMCALC_VALUE_TYPE> values) const{
+	std::map<Equation, Equation> replacements;
+	for(const std::pair<const Equation, SYMCALC_VALUE_TYPE>& value : values){
+		replacements.insert(std::make_pair(value.first, Equation(value.second)));
+	}
+	return this->substitute(replacements);
+}
+
+
+
+
+// Compilation
+
+CompiledEquation Equation::compile(const std::vector<Equation>& variables, const std::vector<Equation>& parameters) const{
+	return CompiledEquation(*this, variables, parameters);
+}
+
+
+
+
+// Second derivatives
+
+SparseHessian Equation::hessian(const std::vector<Equation>& variables) const{
+	return SparseHessian(*this, variables);
 }
 
 
@@ -0,0 +1,341 @@
+// Copyright 2024 Kyrylo Shyshko
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symcalc/symcalc.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_set>
+
+//
+// gradient.cpp:
+// Symbolic gradients and Jacobians built by reverse accumulation
+// The adjoint of every node is built once and shared by the partial derivatives of all the variables below it,
+// so the gradient grows with the size of the expression instead of its size times the number of variables
+//
+
+namespace symcalc{
+
+
+namespace{
+
+class Adjoints{
+public:
+	std::vector<SYMCALC_VAR_NAME_TYPE> variables; // Sorted
+
+	std::vector<const EquationBase*> order; // Children before their parents
+	std::unordered_set<const EquationBase*> visited;
+	std::unordered_map<const EquationBase*, std::vector<EquationBase*>> contributions;
+	std::unordered_set<const EquationBase*> groups; // Grouped products created for long Mult nodes
+
+	Adjoints(std::vector<SYMCALC_VAR_NAME_TYPE> variables);
+	~Adjoints();
+
+	bool relevant(const EquationBase* eq) const;
+	void visit(const EquationBase* eq);
+
+	void add(const EquationBase* eq, EquationBase* contribution);
+	void add_scaled(const EquationBase* eq, const EquationBase* adjoint, EquationBase* partial);
+	EquationBase* total(const EquationBase* eq);
+
+	void propagate(const EquationBase* eq, const EquationBase* adjoint);
+	void propagate_product(const std::vector<EquationBase*>& factors, const EquationBase* adjoint);
+	void propagate_group(const EquationBase* group, const EquationBase* adjoint);
+
+	std::vector<EquationBase*> run(const EquationBase* eq);
+};
+
+
+Adjoints::Adjoints(std::vector<SYMCALC_VAR_NAME_TYPE> variables) : variables(variables){
+	std::sort(this->variables.begin(), this->variables.end());
+}
+
+Adjoints::~Adjoints(){
+	for(std::pair<const EquationBase* const, std::vector<EquationBase*>>& node_contributions : contributions){
+		for(EquationBase* contribution : node_contributions.second){
+			delete_equation_base(contribution);
+		}
+	}
+	for(const EquationBase* group : groups){
+		delete_equation_base(const_cast<EquationBase*>(group));
+	}
+}
+
+
+// Only nodes that depend on one of the variables get an adjoint
+bool Adjoints::relevant(const EquationBase* eq) const{
+	const std::vector<SYMCALC_VAR_NAME_TYPE>& deps = *eq->dependencies;
+	std::vector<SYMCALC_VAR_NAME_TYPE>::const_iterator var = variables.begin();
+	std::vector<SYMCALC_VAR_NAME_TYPE>::const_iterator dep = deps.begin();
+	while(var != variables.end() && dep != deps.end()){
+		if(*var == *dep) return true;
+		if(*var < *dep) var++;
+		else dep++;
+	}
+	return false;
+}
+
+// Shared nodes are visited once, iteratively so deep expressions don't overflow the stack
+void Adjoints::visit(const EquationBase* root){
+	std::vector<std::pair<const EquationBase*, size_t>> stack;
+	if(relevant(root) && visited.insert(root).second){
+		stack.push_back(std::make_pair(root, 0));
+	}
+
+	while(!stack.empty()){
+		const EquationBase* eq = stack.back().first;
+		size_t next_child = stack.back().second;
+		if(next_child < eq->_children_count()){
+			stack.back().second++;
+			const EquationBase* child = eq->_child(next_child);
+			if(relevant(child) && visited.insert(child).second){
+				stack.push_back(std::make_pair(child, 0));
+			}
+		}else{
+			order.push_back(eq);
+			stack.pop_back();
+		}
+	}
+}
+
+
+// Takes ownership of the contribution
+void Adjoints::add(const EquationBase* eq, EquationBase* contribution){
+	if(!relevant(eq)){
+		delete_equation_base(contribution);
+		return;
+	}
+	contributions[eq].push_back(contribution);
+}
+
+// Adds adjoint * partial, takes ownership of the partial
+// The product is grouped so chains of adjoints are shared instead of flattened into every product
+void Adjoints::add_scaled(const EquationBase* eq, const EquationBase* adjoint, EquationBase* partial){
+	add(eq, new Mult({copy(adjoint), partial}, false));
+}
+
+// Sum of the contributions to a node, nullptr if there are none
+EquationBase* Adjoints::total(const EquationBase* eq){
+	std::unordered_map<const EquationBase*, std::vector<EquationBase*>>::iterator found = contributions.find(eq);
+	if(found == contributions.end()){
+		return nullptr;
+	}
+	std::vector<EquationBase*> node_contributions = found->second;
+	contributions.erase(found);
+	if(node_contributions.size() == 1){
+		return node_contributions[0];
+	}
+	return new Sum(node_contributions);
+}
+
+
+// Same partial derivatives as the _derivative() rules of every node
+void Adjoints::propagate(const EquationBase* eq, const EquationBase* adjoint){
+	if(eq->type == "sum"){
+		for(size_t i = 0; i < eq->_children_count(); i++){
+			add(eq->_child(i), copy(adjoint));
+		}
+	}else if(eq->type == "neg"){
+		add(eq->_child(0), new Negate(copy(adjoint)));
+	}else if(eq->type == "lazy_derivative"){
+		add(eq->_child(0), copy(adjoint));
+	}else if(eq->type == "mult"){
+		propagate_product(dynamic_cast<const Mult*>(eq)->elements, adjoint);
+	}else if(eq->type == "div"){
+		// d(f / g) = df / g - dg * f / g^2
+		const Div* div = dynamic_cast<const Div*>(eq);
+		add(div->dividend, new Div(copy(adjoint), copy(div->divisor)));
+		if(relevant(div->divisor)){
+			EquationBase* divisor_squared = new Power(copy(div->divisor), new EquationValue(2));
+			add_scaled(div->divisor, adjoint, new Negate(new Div(copy(div->dividend), divisor_squared)));
+		}
+	}else if(eq->type == "pow"){
+		// d(g ^ h) = dg * h * g^(h - 1) + dh * g^h * ln(g)
+		const Power* power = dynamic_cast<const Power*>(eq);
+		if(relevant(power->base)){
+			EquationBase* new_power = new Sum({copy(power->power), new EquationValue(-1)});
+			add_scaled(power->base, adjoint, new Mult({copy(power->power), new Power(copy(power->base), new_power)}));
+		}
+		if(relevant(power->power)){
+			add_scaled(power->power, adjoint, new Mult({copy(eq), new Ln(copy(power->base))}));
+		}
+	}else if(eq->type == "log"){
+		// d(log_b(f)) = df / (f * ln(b)) - db * ln(f) / (b * ln(b)^2)
+		const Log* log = dynamic_cast<const Log*>(eq);
+		if(relevant(log->eq)){
+			add(log->eq, new Div(copy(adjoint), new Mult({copy(log->eq), new Ln(copy(log->base))})));
+		}
+		if(relevant(log->base)){
+			EquationBase* bottom = new Mult({copy(log->base), new Power(new Ln(copy(log->base)), new EquationValue(2))});
+			add_scaled(log->base, adjoint, new Negate(new Div(new Ln(copy(log->eq)), bottom)));
+		}
+	}else if(eq->type == "ln"){
+		add(eq->_child(0), new Div(copy(adjoint), copy(eq->_child(0))));
+	}else if(eq->type == "exp"){
+		add_scaled(eq->_child(0), adjoint, copy(eq));
+	}else if(eq->type == "abs"){
+		add_scaled(eq->_child(0), adjoint, new Div(copy(eq->_child(0)), copy(eq)));
+	}else if(eq->type == "sin"){
+		add_scaled(eq->_child(0), adjoint, new Cos(copy(eq->_child(0))));
+	}else if(eq->type == "cos"){
+		add_scaled(eq->_child(0), adjoint, new Negate(new Sin(copy(eq->_child(0)))));
+	}else if(eq->_children_count() > 0){
+		throw std::runtime_error("Can't build the gradient of an expression of type " + eq->type);
+	}
+}
+
+
+// Short products use the product of the other factors as the partial derivative,
+// long ones go through a balanced grouping like Mult::_shared_derivative()
+void Adjoints::propagate_product(const std::vector<EquationBase*>& factors, const EquationBase* adjoint){
+	size_t count = factors.size();
+
+	if(count > Mult::SHARED_PRODUCT_RULE_SIZE){
+		std::vector<EquationBase*> level;
+		for(EquationBase* factor : factors){
+			level.push_back(copy(factor));
+		}
+		while(level.size() > 1){
+			std::vector<EquationBase*> next_level;
+			for(size_t i = 0; i + 1 < level.size(); i += 2){
+				EquationBase* group = new Mult({level[i], level[i + 1]}, false);
+				groups.insert(group);
+				next_level.push_back(copy(group));
+			}
+			if(level.size() % 2 == 1){
+				next_level.push_back(level.back());
+			}
+			level = next_level;
+		}
+		propagate_group(level[0], adjoint);
+		delete_equation_base(level[0]);
+		return;
+	}
+
+	for(size_t i = 0; i < count; i++){
+		if(!relevant(factors[i])){
+			continue;
+		}
+		std::vector<EquationBase*> others;
+		for(size_t j = 0; j < count; j++){
+			if(j != i){
+				others.push_back(copy(factors[j]));
+			}
+		}
+		add_scaled(factors[i], adjoint, others.size() == 1 ? others[0] : new Mult(others));
+	}
+}
+
+void Adjoints::propagate_group(const EquationBase* group, const EquationBase* adjoint){
+	if(groups.count(group) == 0){
+		add(group, copy(adjoint));
+		return;
+	}
+	const Mult* mult = dynamic_cast<const Mult*>(group);
+	for(size_t i = 0; i < 2; i++){
+		const EquationBase* half = mult->elements[i];
+		const EquationBase* other = mult->elements[1 - i];
+		if(!relevant(half)){
+			continue;
+		}
+		EquationBase* half_adjoint = new Mult({copy(adjoint), copy(other)}, false);
+		propagate_group(half, half_adjoint);
+		delete_equation_base(half_adjoint);
+	}
+}
+
+
+// Walks the nodes from the root down, each node passes its adjoint to its children once all its parents are done
+std::vector<EquationBase*> Adjoints::run(const EquationBase* eq){
+	visit(eq);
+	add(eq, new EquationValue(1));
+
+	std::vector<EquationBase*> partials (variables.size(), nullptr);
+
+	for(std::vector<const EquationBase*>::reverse_iterator it = order.rbegin(); it != order.rend(); it++){
+		const EquationBase* node = *it;
+		EquationBase* adjoint = total(node);
+		if(adjoint == nullptr){
+			continue;
+		}
+
+		if(node->type == "var"){
+			const Variable* var = dynamic_cast<const Variable*>(node);
+			size_t index = std::lower_bound(variables.begin(), variables.end(), var->name) - variables.begin();
+			// Separate nodes of the same variable add up
+			partials[index] = partials[index] == nullptr ? adjoint : new Sum({partials[index], adjoint});
+			continue;
+		}
+
+		propagate(node, adjoint);
+		delete_equation_base(adjoint);
+	}
+
+	for(EquationBase*& partial : partials){
+		if(partial == nullptr){
+			partial = new EquationValue(0);
+		}
+	}
+	return partials;
+}
+
+} // End of anonymous namespace
+
+
+
+std::vector<EquationBase*> gradient_equation_base(const EquationBase* eq, const std::vector<SYMCALC_VAR_NAME_TYPE>& variables){
+	Adjoints adjoints (variables);
+	std::vector<EquationBase*> sorted_partials = adjoints.run(eq);
+
+	// Back to the order the variables were given in
+	std::vector<EquationBase*> partials;
+	for(const SYMCALC_VAR_NAME_TYPE& var : variables){
+		size_t index = std::lower_bound(adjoints.variables.begin(), adjoints.variables.end(), var) - adjoints.variables.begin();
+		partials.push_back(copy(sorted_partials[index]));
+	}
+	for(EquationBase* partial : sorted_partials){
+		delete_equation_base(partial);
+	}
+	return partials;
+}
+
+
+std::vector<Equation> Equation::gradient(const std::vector<Equation>& variables) const{
+	std::vector<SYMCALC_VAR_NAME_TYPE> names;
+	for(const Equation& variable : variables){
+		Variable* var = dynamic_cast<Variable*>(variable.eq);
+		if(!var){
+			throw std::runtime_error("Provided variable is not of Variable type");
+		}
+		names.push_back(var->name);
+	}
+
+	std::vector<EquationBase*> partials = gradient_equation_base(eq, names);
+	std::vector<Equation> gradient;
+	for(EquationBase* partial : partials){
+		gradient.push_back(Equation(partial));
+	}
+	return gradient;
+}
+
+
+std::vector<std::vector<Equation>> jacobian(const std::vector<Equation>& equations, const std::vector<Equation>& variables){
+	std::vector<std::vector<Equation>> rows;
+	for(const Equation& equation : equations){
+		rows.push_back(equation.gradient(variables));
+	}
+	return rows;
+}
+
+
+} // End of symcalc namespace
@@ -24,9 +24,11 @@ namespace symcalc{
 
 
 // Functions that help with properly copying and deleting EquationBase pointers
+// Nodes are never modified after construction, so a copy shares the node and increases its reference count
 
 EquationBase* copy(const EquationBase* start_eq){
-	return start_eq->_copy_equation_base();
+	start_eq->references.fetch_add(1, std::memory_order_relaxed);
+	return const_cast<EquationBase*>(start_eq);
 }
 
 std::vector<EquationBase*> copy(std::vector<const EquationBase*> eqs){
@@ -41,9 +43,184 @@ std::vector<EquationBase*> copy(std::vector<const EquationBase*> eqs){
 void delete_equation_base(EquationBase* eq){
 	if(eq == nullptr) return;
 	
-	eq->_delete_equation_base();
+	// Only delete the node once the last owner releases it
+	if(eq->references.fetch_sub(1, std::memory_order_acq_rel) == 1){
+		eq->_delete_equation_base();
+	}
 	eq = nullptr;
 }
 
+
+
+// Structural hashing and comparison
+
+size_t hash_combine(size_t seed, size_t value){
+	return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+bool equal(const EquationBase* eq1, const EquationBase* eq2){
+	if(eq1 == eq2) return true; // Shared nodes are equal without walking them
+	if(eq1->hash_value != eq2->hash_value || eq1->type != eq2->type) return false;
+	return eq1->_equals(eq2);
+}
+
+
+
+// Simplification through the cache
+// Leaves simplify to themselves, so only nodes with children are looked up
+
+// Once an operation is cancelled, nodes are left as they are and the rest of the walk unwinds right away
+// Nothing is thrown through the nodes, which don't own their partial results in a way that survives an exception,
+// and nothing is cached, since the results are only placeholders
+static bool cancelled(const Context& context){
+	return context.cancelled != nullptr && context.cancelled->load(std::memory_order_relaxed);
+}
+
+EquationBase* simplify_equation_base(const EquationBase* eq){
+	if(eq->_children_count() == 0){
+		return eq->_simplify();
+	}
+	
+	const Context& context = Context::current();
+	if(cancelled(context)){
+		return copy(eq);
+	}
+	EquationCache& cache = context.simplifications();
+	
+	EquationBase* cached = cache.find(eq);
+	if(cached != nullptr){
+		return cached;
+	}
+	
+	EquationBase* simplified = eq->_simplify();
+	if(!cancelled(context)){
+		cache.insert(eq, simplified);
+	}
+	return simplified;
+}
+
+
+// Differentiation through the cache
+// Subtrees that don't depend on the variable are zero, and leaves are cheaper to differentiate than to look up
+
+// Set while derivative_step_equation_base() runs, so the children are left lazy instead of being differentiated
+static thread_local bool lazy_children = false;
+
+EquationBase* derivative_equation_base(const EquationBase* eq, const SYMCALC_VAR_NAME_TYPE& var){
+	if(!eq->depends_on(var)){
+		return new EquationValue(0);
+	}
+	if(eq->_children_count() == 0){
+		return eq->_derivative(var);
+	}
+	if(lazy_children){
+		return new LazyDerivative(copy(eq), var);
+	}
+	
+	const Context& context = Context::current();
+	if(cancelled(context)){
+		return new EquationValue(0);
+	}
+	EquationCache& cache = context.derivatives();
+	
+	EquationBase* cached = cache.find(eq, var);
+	if(cached != nullptr){
+		return cached;
+	}
+	
+	EquationBase* deriv = eq->_derivative(var);
+	if(!cancelled(context)){
+		cache.insert(eq, deriv, var);
+	}
+	return deriv;
+}
+
+// Steps aren't cached, since their children are lazy
+EquationBase* derivative_step_equation_base(const EquationBase* eq, const SYMCALC_VAR_NAME_TYPE& var){
+	if(!eq->depends_on(var)){
+		return new EquationValue(0);
+	}
+	bool previous = lazy_children;
+	lazy_children = true;
+	EquationBase* deriv;
+	try{
+		deriv = eq->_derivative(var);
+	}catch(...){
+		lazy_children = previous;
+		throw;
+	}
+	lazy_children = previous;
+	return deriv;
+}
+
+
+
+
+// Children of a node, with the parallel path taken only when at least two of them are big
+// Small children run on the calling thread, forking them would cost more than processing them
+// Derivative steps stay on the calling thread, since lazy_children is only set there
+
+// Indices of the children that go to the pool, empty when fewer than two are big
+static std::vector<size_t> forked_children(const std::vector<EquationBase*>& children){
+	const Context& context = Context::current();
+	std::vector<size_t> big;
+	if(context.pool != nullptr && context.pool->size() > 1 && !lazy_children){
+		for(size_t i = 0; i < children.size(); i++){
+			if(children[i]->tree_size >= context.parallel_threshold){
+				big.push_back(i);
+			}
+		}
+	}
+	if(big.size() < 2){
+		big.clear();
+	}
+	return big;
+}
+
+bool forks_children(const std::vector<EquationBase*>& children){
+	return !forked_children(children).empty();
+}
+
+static std::vector<EquationBase*> map_children(const std::vector<EquationBase*>& children, const std::function<EquationBase*(const EquationBase*)>& process){
+	std::vector<EquationBase*> results (children.size(), nullptr);
+	
+	const Context& context = Context::current();
+	std::vector<size_t> big = forked_children(children);
+	
+	try{
+		if(!big.empty()){
+			context.pool->parallel_for(big.size(), [&](size_t i){
+				results[big[i]] = process(children[big[i]]);
+			});
+		}
+		std::vector<size_t>::const_iterator next_big = big.begin();
+		for(size_t i = 0; i < children.size(); i++){
+			if(next_big != big.end() && *next_big == i){
+				next_big++;
+				continue;
+			}
+			results[i] = process(children[i]);
+		}
+	}catch(...){
+		for(EquationBase* result : results){
+			delete_equation_base(result);
+		}
+		throw;
+	}
+	return results;
+}
+
+std::vector<EquationBase*> simplify_children(const std::vector<EquationBase*>& children){
+	return map_children(children, [](const EquationBase* child){
+		return simplify_equation_base(child);
+	});
+}
+
+std::vector<EquationBase*> derivative_children(const std::vector<EquationBase*>& children, const SYMCALC_VAR_NAME_TYPE& var){
+	return map_children(children, [&var](const EquationBase* child) -> EquationBase* {
+		return child->depends_on(var) ? derivative_equation_base(child, var) : nullptr;
+	});
+}
+
 	
 } // End of symcalc namespace
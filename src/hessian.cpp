@@ -0,0 +1,226 @@
+// Copyright 2024 Kyrylo Shyshko
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symcalc/symcalc.hpp"
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+#include <unordered_set>
+
+//
+// hessian.cpp:
+// Sparse Hessians of expressions with many variables
+// The pattern comes from the dependencies of the nodes: two variables can only have a second derivative together
+// if some node combines them nonlinearly, like a product of factors that depend on each of them
+// Columns that never have a nonzero in the same row share a color, and all the columns of a color are recovered
+// from one forward sweep over the compiled gradient
+//
+
+namespace symcalc{
+
+
+namespace{
+
+typedef std::vector<std::set<size_t>> Pattern;
+
+
+// Indices of the variables a node depends on
+std::vector<size_t> variable_indices(const EquationBase* eq, const std::map<SYMCALC_VAR_NAME_TYPE, size_t>& index){
+	std::vector<size_t> indices;
+	for(const SYMCALC_VAR_NAME_TYPE& dep : *eq->dependencies){
+		std::map<SYMCALC_VAR_NAME_TYPE, size_t>::const_iterator found = index.find(dep);
+		if(found != index.end()){
+			indices.push_back(found->second);
+		}
+	}
+	return indices;
+}
+
+// Every variable of the first list can have a second derivative with every variable of the second one
+void couple(Pattern& pattern, const std::vector<size_t>& first, const std::vector<size_t>& second){
+	for(size_t i : first){
+		for(size_t j : second){
+			pattern[i].insert(j);
+			pattern[j].insert(i);
+		}
+	}
+}
+
+// In a product, variables of different factors are coupled, and a variable is coupled with itself if it is in several factors
+// Products of single-variable factors, like x * y * z, don't give squared terms
+void couple_product(Pattern& pattern, const EquationBase* mult, const std::map<SYMCALC_VAR_NAME_TYPE, size_t>& index){
+	std::map<size_t, size_t> factors_count;
+	std::map<size_t, size_t> owner; // The factor of a variable that is only in one factor
+	for(size_t factor = 0; factor < mult->_children_count(); factor++){
+		for(size_t i : variable_indices(mult->_child(factor), index)){
+			factors_count[i]++;
+			owner[i] = factor;
+		}
+	}
+	for(const std::pair<const size_t, size_t>& first : factors_count){
+		for(const std::pair<const size_t, size_t>& second : factors_count){
+			if(first.second > 1 || second.second > 1 || owner[first.first] != owner[second.first]){
+				pattern[first.first].insert(second.first);
+			}
+		}
+	}
+}
+
+// Second derivatives introduced by one node, those of its children are added when they are visited
+// Sums, negations, absolute values and lazy derivatives are linear in their children, abs only has a kink at zero
+void add_interactions(Pattern& pattern, const EquationBase* eq, const std::map<SYMCALC_VAR_NAME_TYPE, size_t>& index){
+	if(eq->type == "sum" || eq->type == "neg" || eq->type == "abs" || eq->type == "lazy_derivative" || eq->_children_count() == 0){
+		return;
+	}
+
+	if(eq->type == "mult"){
+		couple_product(pattern, eq, index);
+	}else if(eq->type == "div"){
+		// f / g is linear in f, but couples f with g and g with itself
+		const Div* div = dynamic_cast<const Div*>(eq);
+		std::vector<size_t> divisor_indices = variable_indices(div->divisor, index);
+		couple(pattern, variable_indices(div->dividend, index), divisor_indices);
+		couple(pattern, divisor_indices, divisor_indices);
+	}else if(eq->type == "pow"){
+		// g ^ 1 is linear in g, every other power is nonlinear in all of its variables
+		const Power* power = dynamic_cast<const Power*>(eq);
+		const EquationValue* exponent = dynamic_cast<const EquationValue*>(power->power);
+		if(!(exponent && exponent->value == 1)){
+			std::vector<size_t> indices = variable_indices(eq, index);
+			couple(pattern, indices, indices);
+		}
+	}else{
+		std::vector<size_t> indices = variable_indices(eq, index);
+		couple(pattern, indices, indices);
+	}
+}
+
+// Shared nodes are visited once, iteratively so deep expressions don't overflow the stack
+Pattern hessian_pattern(const EquationBase* root, const std::map<SYMCALC_VAR_NAME_TYPE, size_t>& index){
+	Pattern pattern (index.size());
+	std::unordered_set<const EquationBase*> visited;
+	std::vector<const EquationBase*> stack;
+	stack.push_back(root);
+	visited.insert(root);
+
+	while(!stack.empty()){
+		const EquationBase* eq = stack.back();
+		stack.pop_back();
+		if(variable_indices(eq, index).empty()){
+			continue;
+		}
+		add_interactions(pattern, eq, index);
+		for(size_t i = 0; i < eq->_children_count(); i++){
+			const EquationBase* child = eq->_child(i);
+			if(visited.insert(child).second){
+				stack.push_back(child);
+			}
+		}
+	}
+	return pattern;
+}
+
+} // End of anonymous namespace
+
+
+
+SparseHessian::SparseHessian(const Equation& equation, const std::vector<Equation>& variables) : gradient(equation.gradient(variables), variables){
+	this->variables = gradient.variables;
+	size_t n = this->variables.size();
+
+	std::map<SYMCALC_VAR_NAME_TYPE, size_t> index;
+	for(size_t i = 0; i < n; i++){
+		index[this->variables[i]] = i;
+	}
+
+	EquationBase* eq = equation.copy_eq();
+	Pattern pattern = hessian_pattern(eq, index);
+	delete_equation_base(eq);
+
+	// CSR and COO forms of the pattern
+	row_offsets.push_back(0);
+	for(size_t i = 0; i < n; i++){
+		for(size_t j : pattern[i]){
+			rows.push_back(i);
+			columns.push_back(j);
+		}
+		row_offsets.push_back(columns.size());
+	}
+
+	// Greedy distance-2 coloring: a column can't share a color with any column that has a nonzero in one of its rows
+	colors.assign(n, n);
+	colors_count = 0;
+	for(size_t j = 0; j < n; j++){
+		std::vector<bool> forbidden (colors_count + 1, false);
+		for(size_t row : pattern[j]){
+			for(size_t other : pattern[row]){
+				if(colors[other] < n){
+					forbidden[colors[other]] = true;
+				}
+			}
+		}
+		colors[j] = std::find(forbidden.begin(), forbidden.end(), false) - forbidden.begin();
+		colors_count = std::max(colors_count, colors[j] + 1);
+	}
+
+	color_entries.resize(colors_count);
+	for(size_t entry = 0; entry < columns.size(); entry++){
+		color_entries[colors[columns[entry]]].push_back(entry);
+	}
+}
+
+
+size_t SparseHessian::nonzeros() const{
+	return columns.size();
+}
+
+size_t SparseHessian::workspace_size() const{
+	return gradient.gradient_workspace_size();
+}
+
+
+// Seeding every column of a color gives the sum of those columns, and each row has at most one nonzero among them
+void SparseHessian::eval(const SYMCALC_VALUE_TYPE* inputs, SYMCALC_VALUE_TYPE* values, SYMCALC_VALUE_TYPE* workspace) const{
+	size_t registers_count = gradient.workspace_size();
+	SYMCALC_VALUE_TYPE* tangents = workspace + registers_count;
+
+	gradient.eval(inputs, workspace);
+
+	for(size_t color = 0; color < colors_count; color++){
+		std::fill(tangents, tangents + registers_count, 0);
+		for(size_t j = 0; j < variables.size(); j++){
+			if(colors[j] == color){
+				tangents[j] = 1;
+			}
+		}
+		gradient._run_tangents(workspace, tangents);
+
+		for(size_t entry : color_entries[color]){
+			values[entry] = tangents[gradient.outputs[rows[entry]]];
+		}
+	}
+}
+
+std::vector<SYMCALC_VALUE_TYPE> SparseHessian::eval(const std::vector<SYMCALC_VALUE_TYPE>& inputs) const{
+	if(inputs.size() != variables.size()){
+		throw std::runtime_error("SparseHessian.eval expects one value per variable");
+	}
+	std::vector<SYMCALC_VALUE_TYPE> workspace (workspace_size());
+	std::vector<SYMCALC_VALUE_TYPE> values (nonzeros());
+	eval(inputs.data(), values.data(), workspace.data());
+	return values;
+}
+
+
+} // End of symcalc namespace
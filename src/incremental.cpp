@@ -0,0 +1,199 @@
+// Copyright 2024 Kyrylo Shyshko
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symcalc/symcalc.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+//
+// incremental.cpp:
+// Definitions for IncrementalEvaluator, which reevaluates a compiled program after a few of its inputs change
+// The instructions reachable from every input are found once, so an update only visits the instructions
+// that can see a changed input, and only reruns those where an operand actually changed
+//
+
+namespace symcalc{
+
+
+// Values are compared by bit pattern, so 0.0 and -0.0 differ (1/x tells them apart), and a NaN always counts as changed
+static bool same_value(SYMCALC_VALUE_TYPE value1, SYMCALC_VALUE_TYPE value2){
+	return !std::isnan(value1) && std::memcmp(&value1, &value2, sizeof(SYMCALC_VALUE_TYPE)) == 0;
+}
+
+
+IncrementalEvaluator::IncrementalEvaluator(const CompiledEquation& program, const std::vector<SYMCALC_VALUE_TYPE>& values) : program(program), last_recomputed(0){
+	size_t inputs_count = program.variables.size();
+	size_t results_begin = inputs_count + program.invariants.size();
+	if(!values.empty() && values.size() != inputs_count){
+		throw std::runtime_error("IncrementalEvaluator expects one value per variable");
+	}
+
+	registers.assign(program.workspace_size(), 0);
+	std::copy(values.begin(), values.end(), registers.begin());
+	changed_registers.assign(registers.size(), false);
+
+	// Instructions that read each register
+	std::vector<std::vector<size_t>> readers (registers.size());
+	for(size_t k = 0; k < program.instructions.size(); k++){
+		const CompiledEquation::Instruction& instruction = program.instructions[k];
+		readers[instruction.a].push_back(k);
+		if(instruction.b != instruction.a){
+			readers[instruction.b].push_back(k);
+		}
+		for(size_t i = instruction.begin; i < instruction.begin + instruction.count; i++){
+			readers[program.operands[i]].push_back(k);
+		}
+	}
+
+	affected.resize(inputs_count);
+	const size_t unvisited = (size_t)-1;
+	std::vector<size_t> visited_from (program.instructions.size(), unvisited);
+	for(size_t input = 0; input < inputs_count; input++){
+		std::vector<size_t> stack = readers[input];
+		while(!stack.empty()){
+			size_t k = stack.back();
+			stack.pop_back();
+			if(visited_from[k] == input){
+				continue;
+			}
+			visited_from[k] = input;
+			affected[input].push_back(k);
+			stack.insert(stack.end(), readers[results_begin + k].begin(), readers[results_begin + k].end());
+		}
+		std::sort(affected[input].begin(), affected[input].end());
+	}
+
+	_recompute_all();
+}
+
+IncrementalEvaluator::IncrementalEvaluator(const Equation& equation, const std::vector<Equation>& variables, const std::vector<SYMCALC_VALUE_TYPE>& values) : IncrementalEvaluator(CompiledEquation(equation, variables), values) {}
+
+
+void IncrementalEvaluator::set(size_t input, SYMCALC_VALUE_TYPE value){
+	if(input >= program.variables.size()){
+		throw std::runtime_error("IncrementalEvaluator.set got an input that isn't one of the variables");
+	}
+	if(same_value(registers[input], value)){
+		return;
+	}
+	registers[input] = value;
+	if(!changed_registers[input]){
+		changed_registers[input] = true;
+		changed_inputs.push_back(input);
+	}
+}
+
+void IncrementalEvaluator::set(const Equation& variable, SYMCALC_VALUE_TYPE value){
+	EquationBase* var_eq = variable.copy_eq();
+	Variable* var = dynamic_cast<Variable*>(var_eq);
+	if(!var){
+		delete_equation_base(var_eq);
+		throw std::runtime_error("Provided variable is not of Variable type");
+	}
+	std::vector<SYMCALC_VAR_NAME_TYPE>::const_iterator found = std::find(program.variables.begin(), program.variables.end(), var->name);
+	delete_equation_base(var_eq);
+	if(found == program.variables.end()){
+		throw std::runtime_error("IncrementalEvaluator.set got a variable that isn't an input of the program");
+	}
+	set(found - program.variables.begin(), value);
+}
+
+SYMCALC_VALUE_TYPE IncrementalEvaluator::get(size_t input) const{
+	return registers.at(input);
+}
+
+
+void IncrementalEvaluator::set_parameters(const std::vector<SYMCALC_VALUE_TYPE>& values){
+	program.set_parameters(values);
+	_recompute_all();
+}
+
+
+SYMCALC_VALUE_TYPE IncrementalEvaluator::eval(){
+	_update();
+	return registers[program.outputs[0]];
+}
+
+std::vector<SYMCALC_VALUE_TYPE> IncrementalEvaluator::eval_all(){
+	_update();
+	std::vector<SYMCALC_VALUE_TYPE> results;
+	results.reserve(program.outputs.size());
+	for(size_t output : program.outputs){
+		results.push_back(registers[output]);
+	}
+	return results;
+}
+
+
+// Instructions run in program order, so every operand is up to date when it's read
+void IncrementalEvaluator::_update(){
+	last_recomputed = 0;
+	if(changed_inputs.empty()){
+		return;
+	}
+
+	std::vector<size_t> pending = affected[changed_inputs[0]];
+	for(size_t i = 1; i < changed_inputs.size(); i++){
+		const std::vector<size_t>& input_affected = affected[changed_inputs[i]];
+		std::vector<size_t> merged;
+		merged.reserve(pending.size() + input_affected.size());
+		std::set_union(pending.begin(), pending.end(), input_affected.begin(), input_affected.end(), std::back_inserter(merged));
+		pending.swap(merged);
+	}
+
+	size_t results_begin = program.variables.size() + program.invariants.size();
+	for(size_t k : pending){
+		const CompiledEquation::Instruction& instruction = program.instructions[k];
+		bool dirty = changed_registers[instruction.a] || changed_registers[instruction.b];
+		for(size_t i = instruction.begin; i < instruction.begin + instruction.count && !dirty; i++){
+			dirty = changed_registers[program.operands[i]];
+		}
+		if(!dirty){
+			continue;
+		}
+
+		SYMCALC_VALUE_TYPE value = program._run_instruction(instruction, registers.data(), false);
+		last_recomputed++;
+		if(!same_value(value, registers[results_begin + k])){
+			registers[results_begin + k] = value;
+			changed_registers[results_begin + k] = true;
+		}
+	}
+
+	for(size_t input : changed_inputs){
+		changed_registers[input] = false;
+	}
+	for(size_t k : pending){
+		changed_registers[results_begin + k] = false;
+	}
+	changed_inputs.clear();
+}
+
+void IncrementalEvaluator::_recompute_all(){
+	size_t results_begin = program.variables.size() + program.invariants.size();
+	std::copy(program.invariants.begin(), program.invariants.end(), registers.begin() + program.variables.size());
+	program._run(program.instructions, registers.data(), registers.data() + results_begin, false);
+	last_recomputed = program.instructions.size();
+
+	for(size_t input : changed_inputs){
+		changed_registers[input] = false;
+	}
+	changed_inputs.clear();
+}
+
+
+} // End of symcalc namespace
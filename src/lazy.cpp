@@ -0,0 +1,144 @@
+// Copyright 2024 Kyrylo Shyshko
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symcalc/symcalc.hpp"
+
+//
+// lazy.cpp:
+// Definitions for LazyDerivative, a derivative that is built one step at a time
+// Creating it costs one node, evaluating it costs one forward-mode pass over the expression,
+// or one Taylor-mode pass for several views on the same variable, and any other use expands only the steps it walks through
+//
+
+namespace symcalc{
+
+
+LazyDerivative::LazyDerivative(EquationBase* eq, SYMCALC_VAR_NAME_TYPE var) : EquationBase("lazy_derivative"), eq(eq), var(var), expansion(nullptr) {
+	_cache_structure();
+}
+
+LazyDerivative::LazyDerivative(const LazyDerivative& lvalue) : EquationBase(lvalue), eq(nullptr), var(lvalue.var), expansion(nullptr){
+	const EquationBase* lvalue_eq = lvalue.eq;
+	eq = copy(lvalue_eq);
+	EquationBase* lvalue_expansion = lvalue.expansion.load(std::memory_order_acquire);
+	if(lvalue_expansion != nullptr){
+		expansion.store(copy(lvalue_expansion), std::memory_order_relaxed);
+	}
+}
+
+LazyDerivative::~LazyDerivative(){
+	delete_equation_base(eq);
+	delete_equation_base(expansion.load(std::memory_order_acquire));
+}
+
+
+// Threads that expand the same view at once keep the first expansion and release their own
+EquationBase* LazyDerivative::_expanded() const{
+	EquationBase* current = expansion.load(std::memory_order_acquire);
+	if(current != nullptr){
+		return current;
+	}
+	EquationBase* built = derivative_step_equation_base(eq, var);
+	if(expansion.compare_exchange_strong(current, built, std::memory_order_acq_rel)){
+		return built;
+	}
+	delete_equation_base(built);
+	return current;
+}
+
+
+std::string LazyDerivative::txt() const{
+	return _expanded()->txt();
+}
+
+// Forward mode with a single direction along the variable, so nothing is expanded
+// Stacked views on the same variable are evaluated in Taylor mode on the innermost expression instead
+SYMCALC_VALUE_TYPE LazyDerivative::eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
+	if(eq->type == "lazy_derivative" && dynamic_cast<const LazyDerivative*>(eq)->var == var){
+		return eval_taylor(var_hash, var, 0)[0];
+	}
+	SYMCALC_DUAL_HASH_TYPE dual_hash;
+	for(const std::pair<const SYMCALC_VAR_NAME_TYPE, SYMCALC_VALUE_TYPE>& value : var_hash){
+		dual_hash[value.first] = Dual::constant(value.second, 1);
+	}
+	dual_hash[var].tangents.assign(1, 1);
+	return eq->eval_dual(dual_hash, 1).tangents[0];
+}
+
+Dual LazyDerivative::eval_dual(const SYMCALC_DUAL_HASH_TYPE& var_hash, size_t lanes) const{
+	return _expanded()->eval_dual(var_hash, lanes);
+}
+
+// Along the variable of the view, the series is the series of the expression shifted by one power, since d/dx x^(k+1) = (k+1) x^k
+TaylorSeries LazyDerivative::eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const{
+	if(var != this->var){
+		return _expanded()->eval_taylor(var_hash, var, order);
+	}
+	TaylorSeries series = eq->eval_taylor(var_hash, var, order + 1);
+	for(size_t k = 0; k <= order; k++){
+		series[k] = (k + 1) * series[k + 1];
+	}
+	series.pop_back();
+	return series;
+}
+
+std::vector<SYMCALC_VAR_NAME_TYPE> LazyDerivative::list_variables() const{
+	return _expanded()->list_variables();
+}
+
+EquationBase* LazyDerivative::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
+	return derivative_equation_base(_expanded(), var);
+}
+
+EquationBase* LazyDerivative::_simplify() const{
+	return simplify_equation_base(_expanded());
+}
+
+
+size_t LazyDerivative::_children_count() const{
+	return 1;
+}
+
+EquationBase* LazyDerivative::_child(size_t i) const{
+	return _expanded();
+}
+
+EquationBase* LazyDerivative::_rebuild(std::vector<EquationBase*> children) const{
+	return children[0];
+}
+
+bool LazyDerivative::_equals(const EquationBase* other) const{
+	const LazyDerivative* casted = dynamic_cast<const LazyDerivative*>(other);
+	return casted->var == this->var && equal(this->eq, casted->eq);
+}
+
+// The derivative can only depend on the variables of the expression
+void LazyDerivative::_cache_structure(){
+	this->hash_value = hash_combine(hash_combine(std::hash<std::string>()(type), eq->hash_value), std::hash<SYMCALC_VAR_NAME_TYPE>()(var));
+	this->dependencies = eq->dependencies;
+	this->tree_size = eq->tree_size + 1;
+}
+
+
+EquationBase* LazyDerivative::_copy_equation_base() const{
+	const LazyDerivative* casted = dynamic_cast<const LazyDerivative*>(this);
+	return new LazyDerivative(*casted);
+}
+void LazyDerivative::_delete_equation_base(){
+	LazyDerivative* casted = dynamic_cast<LazyDerivative*>(this);
+	delete casted;
+}
+
+
+} // End of symcalc namespace
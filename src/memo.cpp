@@ -0,0 +1,142 @@
+// Copyright 2024 Kyrylo Shyshko
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symcalc/symcalc.hpp"
+#include <cstring>
+#include <stdexcept>
+
+//
+// memo.cpp:
+// Definitions for MemoizedEquation, a bounded cache of evaluation results
+// Made for iterative solvers and line searches that come back to the same points,
+// a hit costs one hash of the inputs instead of a run over the instructions
+//
+
+namespace symcalc{
+
+
+// Bit patterns, so 0.0 and -0.0 are different inputs and a NaN matches itself
+size_t MemoizedEquation::InputsHash::operator()(const std::vector<SYMCALC_VALUE_TYPE>& inputs) const{
+	size_t hash = inputs.size();
+	for(SYMCALC_VALUE_TYPE input : inputs){
+		unsigned long long bits = 0;
+		std::memcpy(&bits, &input, sizeof(input) < sizeof(bits) ? sizeof(input) : sizeof(bits));
+		hash = hash_combine(hash, std::hash<unsigned long long>()(bits));
+	}
+	return hash;
+}
+
+bool MemoizedEquation::InputsEqual::operator()(const std::vector<SYMCALC_VALUE_TYPE>& inputs1, const std::vector<SYMCALC_VALUE_TYPE>& inputs2) const{
+	return inputs1.size() == inputs2.size() && std::memcmp(inputs1.data(), inputs2.data(), inputs1.size() * sizeof(SYMCALC_VALUE_TYPE)) == 0;
+}
+
+
+
+MemoizedEquation::MemoizedEquation(const CompiledEquation& program, size_t capacity) : program(program), capacity(capacity), hand(0), hits(0), misses(0), evictions(0){
+	if(capacity == 0){
+		throw std::runtime_error("MemoizedEquation needs room for at least one result");
+	}
+	slots.reserve(capacity);
+	slot_entries.reserve(capacity);
+	results.resize(capacity * program.outputs.size());
+	referenced.assign(capacity, false);
+	workspace.resize(program.workspace_size());
+}
+
+MemoizedEquation::MemoizedEquation(const Equation& equation, const std::vector<Equation>& variables, size_t capacity) : MemoizedEquation(CompiledEquation(equation, variables), capacity) {}
+
+
+SYMCALC_VALUE_TYPE MemoizedEquation::eval(const std::vector<SYMCALC_VALUE_TYPE>& inputs){
+	return _lookup(inputs)[0];
+}
+
+SYMCALC_VALUE_TYPE MemoizedEquation::operator()(const std::vector<SYMCALC_VALUE_TYPE>& inputs){
+	return eval(inputs);
+}
+
+std::vector<SYMCALC_VALUE_TYPE> MemoizedEquation::eval_all(const std::vector<SYMCALC_VALUE_TYPE>& inputs){
+	const SYMCALC_VALUE_TYPE* row = _lookup(inputs);
+	return std::vector<SYMCALC_VALUE_TYPE>(row, row + program.outputs.size());
+}
+
+
+void MemoizedEquation::set_parameters(const std::vector<SYMCALC_VALUE_TYPE>& values){
+	program.set_parameters(values);
+	clear();
+}
+
+void MemoizedEquation::clear(){
+	slots.clear();
+	slot_entries.clear();
+	referenced.assign(capacity, false);
+	hand = 0;
+}
+
+void MemoizedEquation::reset_counters(){
+	hits = 0;
+	misses = 0;
+	evictions = 0;
+}
+
+double MemoizedEquation::hit_rate() const{
+	size_t lookups = hits + misses;
+	return lookups == 0 ? 0 : (double)hits / lookups;
+}
+
+size_t MemoizedEquation::size() const{
+	return slots.size();
+}
+
+
+const SYMCALC_VALUE_TYPE* MemoizedEquation::_lookup(const std::vector<SYMCALC_VALUE_TYPE>& inputs){
+	if(inputs.size() != program.variables.size()){
+		throw std::runtime_error("MemoizedEquation.eval expects one value per variable");
+	}
+	size_t outputs_count = program.outputs.size();
+
+	SlotMap::iterator found = slots.find(inputs);
+	if(found != slots.end()){
+		hits++;
+		referenced[found->second] = true;
+		return &results[found->second * outputs_count];
+	}
+
+	misses++;
+	size_t slot = _free_slot();
+	program.eval_all(inputs.data(), &results[slot * outputs_count], workspace.data());
+	slot_entries[slot] = slots.emplace(inputs, slot).first;
+	return &results[slot * outputs_count];
+}
+
+// New results start with their bit unset, so points that are only seen once are the first to go
+size_t MemoizedEquation::_free_slot(){
+	if(slot_entries.size() < capacity){
+		slot_entries.push_back(slots.end());
+		return slot_entries.size() - 1;
+	}
+
+	while(referenced[hand]){
+		referenced[hand] = false;
+		hand = (hand + 1) % capacity;
+	}
+	size_t slot = hand;
+	hand = (hand + 1) % capacity;
+
+	slots.erase(slot_entries[slot]);
+	evictions++;
+	return slot;
+}
+
+
+} // End of symcalc namespace
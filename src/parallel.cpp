@@ -0,0 +1,231 @@
+// Copyright 2024 Kyrylo Shyshko
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symcalc/symcalc.hpp"
+#include <algorithm>
+#include <chrono>
+#include <exception>
+
+//
+// parallel.cpp:
+// Definitions for ThreadPool and the bulk processing of equations on it
+// Indices of a parallel_for() are handed out one at a time from a shared counter,
+// so threads that get cheap equations simply take more of them
+//
+
+namespace symcalc{
+
+
+// One parallel_for(), shared by the calling thread and the workers that pick it up
+struct ThreadPool::Job{
+	std::function<void(size_t)> task;
+	size_t count;
+	Context context;
+	
+	std::atomic<size_t> next;
+	std::atomic<size_t> finished;
+	std::atomic<bool> failed;
+	std::exception_ptr error;
+	
+	std::mutex mutex;
+	std::condition_variable done;
+	
+	Job(const std::function<void(size_t)>& task, size_t count) : task(task), count(count), context(Context::current()), next(0), finished(0), failed(false) {}
+	
+	void run(){
+		for(size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)){
+			if(!failed.load(std::memory_order_relaxed)){
+				try{
+					task(i);
+				}catch(...){
+					std::lock_guard<std::mutex> lock(mutex);
+					if(!failed.exchange(true)){
+						error = std::current_exception();
+					}
+				}
+			}
+			if(finished.fetch_add(1) + 1 == count){
+				std::lock_guard<std::mutex> lock(mutex);
+				done.notify_all();
+			}
+		}
+	}
+};
+
+
+
+ThreadPool::ThreadPool(size_t threads) : stopping(false){
+	if(threads == 0){
+		threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	}
+	for(size_t i = 1; i < threads; i++){
+		workers.push_back(std::thread(&ThreadPool::_work, this));
+	}
+}
+
+ThreadPool::~ThreadPool(){
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	job_added.notify_all();
+	for(std::thread& worker : workers){
+		worker.join();
+	}
+}
+
+
+size_t ThreadPool::size() const{
+	return workers.size() + 1;
+}
+
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)>& task){
+	if(count == 0){
+		return;
+	}
+	
+	std::shared_ptr<Job> job = std::make_shared<Job>(task, count);
+	size_t helpers = std::min(workers.size(), count - 1);
+	if(helpers > 0){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for(size_t i = 0; i < helpers; i++){
+				jobs.push_back(job);
+			}
+		}
+		if(helpers == workers.size()){
+			job_added.notify_all();
+		}else{
+			for(size_t i = 0; i < helpers; i++){
+				job_added.notify_one();
+			}
+		}
+	}
+	
+	job->run();
+	
+	// Indices still running on other threads can fork jobs of their own, which this thread helps with instead of sleeping
+	while(job->finished.load() != job->count){
+		std::shared_ptr<Job> other = _take_job();
+		if(other != nullptr){
+			ContextScope scope (other->context);
+			other->run();
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(job->mutex);
+		job->done.wait_for(lock, std::chrono::microseconds(100), [&job](){
+			return job->finished.load() == job->count;
+		});
+	}
+	if(job->error){
+		std::rethrow_exception(job->error);
+	}
+}
+
+
+void ThreadPool::submit(const std::function<void()>& task){
+	if(workers.empty()){
+		try{
+			task();
+		}catch(...){}
+		return;
+	}
+	std::shared_ptr<Job> job = std::make_shared<Job>([task](size_t){
+		task();
+	}, 1);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(job);
+	}
+	job_added.notify_one();
+}
+
+
+// Workers that pick up a job after it is finished find no indices left and move on
+void ThreadPool::_work(){
+	while(true){
+		std::shared_ptr<Job> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			job_added.wait(lock, [this](){
+				return stopping || !jobs.empty();
+			});
+			if(jobs.empty()){
+				return;
+			}
+			job = jobs.front();
+			jobs.pop_front();
+		}
+		ContextScope scope (job->context);
+		job->run();
+	}
+}
+
+// Next job that still has indices to hand out, or nullptr
+std::shared_ptr<ThreadPool::Job> ThreadPool::_take_job(){
+	std::lock_guard<std::mutex> lock(mutex);
+	while(!jobs.empty()){
+		std::shared_ptr<Job> job = jobs.front();
+		jobs.pop_front();
+		if(job->next.load(std::memory_order_relaxed) < job->count){
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+
+ThreadPool& thread_pool(){
+	static ThreadPool pool;
+	return pool;
+}
+
+ThreadPool& async_pool(){
+	static ThreadPool pool (std::max<size_t>(std::thread::hardware_concurrency(), 2));
+	return pool;
+}
+
+
+
+BulkRequest::BulkRequest() : simplify(false), compile(false) {}
+
+BulkResult::BulkResult() : equation(0.0) {}
+
+
+std::vector<BulkResult> process_equations(const std::vector<Equation>& equations, const BulkRequest& request, ThreadPool& pool){
+	std::vector<BulkResult> results (equations.size());
+	
+	pool.parallel_for(equations.size(), [&](size_t i){
+		BulkResult& result = results[i];
+		result.equation = request.simplify ? equations[i].simplify() : equations[i];
+		
+		for(const Equation& variable : request.derivatives){
+			Equation derivative = result.equation.derivative(variable);
+			result.derivatives.push_back(request.simplify ? derivative.simplify() : derivative);
+		}
+		
+		if(request.compile){
+			std::vector<Equation> outputs (1, result.equation);
+			outputs.insert(outputs.end(), result.derivatives.begin(), result.derivatives.end());
+			const std::vector<Equation>& variables = request.variables.empty() ? equations[i].list_variables() : request.variables;
+			result.program = std::make_shared<const CompiledEquation>(outputs, variables);
+		}
+	});
+	
+	return results;
+}
+
+
+} // End of symcalc namespace
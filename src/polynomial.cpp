@@ -0,0 +1,473 @@
+// Copyright 2024 Kyrylo Shyshko
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symcalc/symcalc.hpp"
+#include <algorithm>
+
+//
+// polynomial.cpp:
+// Definitions for the sparse multivariate Polynomial class and expansion of polynomial subtrees
+//
+
+namespace symcalc{
+
+
+size_t Polynomial::MonomialHash::operator()(const Monomial& monomial) const{
+	size_t hash = monomial.size();
+	for(unsigned int exponent : monomial){
+		hash = hash_combine(hash, exponent);
+	}
+	return hash;
+}
+
+
+
+// Constructors
+
+Polynomial::Polynomial() {}
+
+Polynomial::Polynomial(SYMCALC_VALUE_TYPE constant){
+	if(constant != 0){
+		terms[Monomial()] = constant;
+	}
+}
+
+Polynomial Polynomial::variable(SYMCALC_VAR_NAME_TYPE name){
+	Polynomial result;
+	result.variables.push_back(name);
+	result.terms[Monomial({1})] = 1;
+	return result;
+}
+
+
+
+// Alignment of monomials to a superset of the variables, new_variables has to be sorted
+
+Polynomial Polynomial::_aligned(const std::vector<SYMCALC_VAR_NAME_TYPE>& new_variables) const{
+	if(new_variables == variables){
+		return *this;
+	}
+
+	std::vector<size_t> positions;
+	positions.reserve(variables.size());
+	for(const SYMCALC_VAR_NAME_TYPE& var : variables){
+		positions.push_back(std::lower_bound(new_variables.begin(), new_variables.end(), var) - new_variables.begin());
+	}
+
+	Polynomial result;
+	result.variables = new_variables;
+	result.terms.reserve(terms.size());
+
+	for(const std::pair<const Monomial, SYMCALC_VALUE_TYPE>& term : terms){
+		Monomial monomial(new_variables.size(), 0);
+		for(size_t i = 0; i < term.first.size(); i++){
+			monomial[positions[i]] = term.first[i];
+		}
+		result.terms[monomial] = term.second;
+	}
+
+	return result;
+}
+
+void Polynomial::_remove_zeros(){
+	for(TermTable::iterator it = terms.begin(); it != terms.end();){
+		if(it->second == 0){
+			it = terms.erase(it);
+		}else{
+			it++;
+		}
+	}
+}
+
+
+static std::vector<SYMCALC_VAR_NAME_TYPE> merge_variables(const std::vector<SYMCALC_VAR_NAME_TYPE>& vars1, const std::vector<SYMCALC_VAR_NAME_TYPE>& vars2){
+	std::vector<SYMCALC_VAR_NAME_TYPE> merged;
+	merged.reserve(vars1.size() + vars2.size());
+	std::set_union(vars1.begin(), vars1.end(), vars2.begin(), vars2.end(), std::back_inserter(merged));
+	return merged;
+}
+
+
+
+// Arithmetic
+
+Polynomial operator+(const Polynomial& p1, const Polynomial& p2){
+	std::vector<SYMCALC_VAR_NAME_TYPE> vars = merge_variables(p1.variables, p2.variables);
+	Polynomial result = p1._aligned(vars);
+	Polynomial aligned = p2._aligned(vars);
+
+	for(const std::pair<const Polynomial::Monomial, SYMCALC_VALUE_TYPE>& term : aligned.terms){
+		result.terms[term.first] += term.second;
+	}
+
+	result._remove_zeros();
+	return result;
+}
+
+Polynomial operator-(const Polynomial& p1){
+	Polynomial result = p1;
+	for(std::pair<const Polynomial::Monomial, SYMCALC_VALUE_TYPE>& term : result.terms){
+		term.second = -term.second;
+	}
+	return result;
+}
+
+Polynomial operator-(const Polynomial& p1, const Polynomial& p2){
+	return p1 + (-p2);
+}
+
+Polynomial operator*(const Polynomial& p1, const Polynomial& p2){
+	std::vector<SYMCALC_VAR_NAME_TYPE> vars = merge_variables(p1.variables, p2.variables);
+	Polynomial aligned1 = p1._aligned(vars);
+	Polynomial aligned2 = p2._aligned(vars);
+
+	Polynomial result;
+	result.variables = vars;
+	result.terms.reserve(aligned1.terms.size() * aligned2.terms.size());
+
+	Polynomial::Monomial monomial(vars.size());
+
+	for(const std::pair<const Polynomial::Monomial, SYMCALC_VALUE_TYPE>& term1 : aligned1.terms){
+		for(const std::pair<const Polynomial::Monomial, SYMCALC_VALUE_TYPE>& term2 : aligned2.terms){
+			for(size_t i = 0; i < vars.size(); i++){
+				monomial[i] = term1.first[i] + term2.first[i];
+			}
+			result.terms[monomial] += term1.second * term2.second;
+		}
+	}
+
+	result._remove_zeros();
+	return result;
+}
+
+// Exponentiation by squaring
+Polynomial Polynomial::pow(unsigned int power) const{
+	Polynomial result (1.0);
+	Polynomial square = *this;
+
+	while(power > 0){
+		if(power & 1){
+			result = result * square;
+		}
+		power >>= 1;
+		if(power > 0){
+			square = square * square;
+		}
+	}
+
+	return result;
+}
+
+
+Polynomial Polynomial::derivative(const SYMCALC_VAR_NAME_TYPE& var) const{
+	Polynomial result;
+	result.variables = variables;
+
+	std::vector<SYMCALC_VAR_NAME_TYPE>::const_iterator found = std::lower_bound(variables.begin(), variables.end(), var);
+	if(found == variables.end() || *found != var){
+		return result;
+	}
+	size_t position = found - variables.begin();
+
+	for(const std::pair<const Monomial, SYMCALC_VALUE_TYPE>& term : terms){
+		unsigned int exponent = term.first[position];
+		if(exponent == 0) continue;
+
+		Monomial monomial = term.first;
+		monomial[position] = exponent - 1;
+		result.terms[monomial] += term.second * exponent;
+	}
+
+	result._remove_zeros();
+	return result;
+}
+
+
+SYMCALC_VALUE_TYPE Polynomial::eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
+	std::vector<SYMCALC_VALUE_TYPE> values;
+	values.reserve(variables.size());
+	for(const SYMCALC_VAR_NAME_TYPE& var : variables){
+		SYMCALC_VAR_HASH_TYPE::const_iterator found = var_hash.find(var);
+		values.push_back(found == var_hash.end() ? 0.0 : found->second);
+	}
+
+	SYMCALC_VALUE_TYPE result = 0;
+	for(const std::pair<const Monomial, SYMCALC_VALUE_TYPE>& term : terms){
+		SYMCALC_VALUE_TYPE product = term.second;
+		for(size_t i = 0; i < term.first.size(); i++){
+			for(unsigned int e = 0; e < term.first[i]; e++){
+				product *= values[i];
+			}
+		}
+		result += product;
+	}
+	return result;
+}
+
+
+
+// Properties
+
+unsigned int Polynomial::degree(const SYMCALC_VAR_NAME_TYPE& var) const{
+	std::vector<SYMCALC_VAR_NAME_TYPE>::const_iterator found = std::lower_bound(variables.begin(), variables.end(), var);
+	if(found == variables.end() || *found != var){
+		return 0;
+	}
+	size_t position = found - variables.begin();
+
+	unsigned int max_degree = 0;
+	for(const std::pair<const Monomial, SYMCALC_VALUE_TYPE>& term : terms){
+		max_degree = std::max(max_degree, term.first[position]);
+	}
+	return max_degree;
+}
+
+unsigned int Polynomial::degree() const{
+	unsigned int max_degree = 0;
+	for(const std::pair<const Monomial, SYMCALC_VALUE_TYPE>& term : terms){
+		unsigned int total = 0;
+		for(unsigned int exponent : term.first){
+			total += exponent;
+		}
+		max_degree = std::max(max_degree, total);
+	}
+	return max_degree;
+}
+
+size_t Polynomial::size() const{
+	return terms.size();
+}
+
+bool Polynomial::is_constant() const{
+	return degree() == 0;
+}
+
+SYMCALC_VALUE_TYPE Polynomial::constant_value() const{
+	SYMCALC_VALUE_TYPE value = 0;
+	for(const std::pair<const Monomial, SYMCALC_VALUE_TYPE>& term : terms){
+		bool constant = true;
+		for(unsigned int exponent : term.first){
+			if(exponent != 0) constant = false;
+		}
+		if(constant) value += term.second;
+	}
+	return value;
+}
+
+
+
+//
+// Conversion from expressions
+//
+
+// Exponents are only accepted if they are non-negative whole numbers
+static bool whole_exponent(const Polynomial& power, unsigned int& exponent){
+	if(!power.is_constant()) return false;
+	SYMCALC_VALUE_TYPE value = power.constant_value();
+	if(value < 0 || value != std::floor(value) || value > 4096) return false;
+	exponent = (unsigned int)value;
+	return true;
+}
+
+// Combines polynomial children of a node of the given type, returns false if the node isn't polynomial
+static bool combine_polynomials(const EquationBase* eq, std::vector<Polynomial>& children, Polynomial& result){
+	if(eq->type == "sum"){
+		result = Polynomial();
+		for(const Polynomial& child : children){
+			result = result + child;
+		}
+	}else if(eq->type == "mult"){
+		result = Polynomial(1.0);
+		for(const Polynomial& child : children){
+			result = result * child;
+		}
+	}else if(eq->type == "neg"){
+		result = -children[0];
+	}else if(eq->type == "div"){
+		if(!children[1].is_constant() || children[1].constant_value() == 0) return false;
+		result = children[0] * Polynomial(1.0 / children[1].constant_value());
+	}else if(eq->type == "pow"){
+		unsigned int exponent;
+		if(children[0].is_constant() && children[1].is_constant()){
+			result = Polynomial(std::pow(children[0].constant_value(), children[1].constant_value()));
+		}else if(whole_exponent(children[1], exponent)){
+			result = children[0].pow(exponent);
+		}else{
+			return false;
+		}
+	}else{
+		// Other functions are only polynomial when they are constant, e.g. sin(2)
+		for(const Polynomial& child : children){
+			if(!child.is_constant()) return false;
+		}
+		result = Polynomial(eq->eval(SYMCALC_VAR_HASH_TYPE()));
+	}
+	return true;
+}
+
+
+bool Polynomial::from_equation_base(const EquationBase* eq, Polynomial& result){
+	if(eq->type == "var"){
+		result = Polynomial::variable(dynamic_cast<const Variable*>(eq)->name);
+		return true;
+	}else if(eq->type == "val" || eq->type == "const"){
+		result = Polynomial(dynamic_cast<const EquationValue*>(eq)->value);
+		return true;
+	}
+
+	std::vector<Polynomial> children (eq->_children_count());
+	for(size_t i = 0; i < children.size(); i++){
+		if(!from_equation_base(eq->_child(i), children[i])){
+			return false;
+		}
+	}
+
+	return combine_polynomials(eq, children, result);
+}
+
+bool Polynomial::from_equation(const Equation& eq, Polynomial& result){
+	EquationBase* eq_base = eq.copy_eq();
+	bool converted = from_equation_base(eq_base, result);
+	delete_equation_base(eq_base);
+	return converted;
+}
+
+
+
+//
+// Conversion to expressions
+//
+
+// Monomials are written from the highest total degree to the lowest, so the output doesn't depend on hashing
+static bool monomial_order(const std::pair<Polynomial::Monomial, SYMCALC_VALUE_TYPE>& term1, const std::pair<Polynomial::Monomial, SYMCALC_VALUE_TYPE>& term2){
+	unsigned int degree1 = 0, degree2 = 0;
+	for(unsigned int exponent : term1.first) degree1 += exponent;
+	for(unsigned int exponent : term2.first) degree2 += exponent;
+	if(degree1 != degree2) return degree1 > degree2;
+	return term1.first > term2.first;
+}
+
+EquationBase* Polynomial::to_equation_base() const{
+	std::vector<std::pair<Monomial, SYMCALC_VALUE_TYPE> > sorted_terms (terms.begin(), terms.end());
+	std::sort(sorted_terms.begin(), sorted_terms.end(), monomial_order);
+
+	std::vector<EquationBase*> summands;
+	summands.reserve(sorted_terms.size());
+
+	for(const std::pair<Monomial, SYMCALC_VALUE_TYPE>& term : sorted_terms){
+		SYMCALC_VALUE_TYPE coeff = term.second < 0 ? -term.second : term.second;
+
+		std::vector<EquationBase*> factors;
+		for(size_t i = 0; i < term.first.size(); i++){
+			if(term.first[i] == 0) continue;
+			EquationBase* var = new Variable(variables[i]);
+			if(term.first[i] == 1){
+				factors.push_back(var);
+			}else{
+				factors.push_back(new Power(var, new EquationValue(term.first[i])));
+			}
+		}
+		if(coeff != 1 || factors.size() == 0){
+			factors.insert(factors.begin(), new EquationValue(coeff));
+		}
+
+		EquationBase* summand = factors.size() == 1 ? factors[0] : new Mult(factors);
+		if(term.second < 0){
+			summand = new Negate(summand);
+		}
+		summands.push_back(summand);
+	}
+
+	if(summands.size() == 0){
+		return new EquationValue(0);
+	}else if(summands.size() == 1){
+		return summands[0];
+	}
+	return new Sum(summands);
+}
+
+Equation Polynomial::to_equation() const{
+	return Equation(to_equation_base());
+}
+
+
+
+//
+// Expansion
+//
+
+// Expands the node bottom-up, either into a polynomial (returns true) or into a rebuilt node with expanded children
+// Named constants are kept as they are, like the factors that aren't polynomial, instead of being replaced by their value
+static bool expand_node(const EquationBase* eq, Polynomial& poly, EquationBase*& node){
+	if(eq->type == "const"){
+		node = copy(eq);
+		return false;
+	}
+	if(eq->type == "var" || eq->type == "val"){
+		return Polynomial::from_equation_base(eq, poly);
+	}
+
+	size_t count = eq->_children_count();
+	std::vector<Polynomial> polys (count);
+	std::vector<EquationBase*> nodes (count, nullptr);
+	bool all_polynomial = true;
+
+	for(size_t i = 0; i < count; i++){
+		if(!expand_node(eq->_child(i), polys[i], nodes[i])){
+			all_polynomial = false;
+		}
+	}
+
+	if(all_polynomial && combine_polynomials(eq, polys, poly)){
+		return true;
+	}
+
+	// The polynomial factors of a product are multiplied out, the other factors are kept in front of them
+	if(eq->type == "mult"){
+		Polynomial product (1.0);
+		std::vector<EquationBase*> factors;
+		for(size_t i = 0; i < count; i++){
+			if(nodes[i] == nullptr){
+				product = product * polys[i];
+			}else{
+				factors.push_back(nodes[i]);
+			}
+		}
+		if(!product.is_constant() || product.constant_value() != 1){
+			factors.push_back(product.to_equation_base());
+		}
+		node = factors.size() == 1 ? factors[0] : eq->_rebuild(factors);
+		return false;
+	}
+
+	for(size_t i = 0; i < count; i++){
+		if(nodes[i] == nullptr){
+			nodes[i] = polys[i].to_equation_base();
+		}
+	}
+	node = eq->_rebuild(nodes);
+	return false;
+}
+
+EquationBase* expand_equation_base(const EquationBase* eq){
+	Polynomial poly;
+	EquationBase* node = nullptr;
+	if(expand_node(eq, poly, node)){
+		return poly.to_equation_base();
+	}
+	return node;
+}
+
+
+} // End of symcalc namespace
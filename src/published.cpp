@@ -0,0 +1,89 @@
+// Copyright 2024 Kyrylo Shyshko
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symcalc/symcalc.hpp"
+#include <stdexcept>
+
+//
+// published.cpp:
+// Definitions for PublishedEquation, read-copy-update of compiled formulas
+// The program pointer is swapped with the atomic shared_ptr functions, and the version counter
+// tells readers when it's worth loading it again
+//
+
+namespace symcalc{
+
+
+PublishedEquation::PublishedEquation(const CompiledEquation& program) : current(std::make_shared<const CompiledEquation>(program)), current_version(0) {}
+
+PublishedEquation::PublishedEquation(const Equation& equation, const std::vector<Equation>& variables, const std::vector<Equation>& parameters) : PublishedEquation(CompiledEquation(equation, variables, parameters)) {}
+
+
+// The pointer is stored before the version is bumped, so a reader that sees the new version loads the new program
+void PublishedEquation::publish(Snapshot program){
+	if(program == nullptr){
+		throw std::runtime_error("PublishedEquation can't publish an empty program");
+	}
+	std::lock_guard<std::mutex> lock(publish_mutex);
+	std::atomic_store_explicit(&current, program, std::memory_order_release);
+	current_version.fetch_add(1, std::memory_order_release);
+}
+
+void PublishedEquation::publish(const CompiledEquation& program){
+	publish(std::make_shared<const CompiledEquation>(program));
+}
+
+void PublishedEquation::publish(const Equation& equation, const std::vector<Equation>& variables, const std::vector<Equation>& parameters){
+	publish(std::make_shared<const CompiledEquation>(equation, variables, parameters));
+}
+
+
+PublishedEquation::Snapshot PublishedEquation::snapshot() const{
+	return std::atomic_load_explicit(&current, std::memory_order_acquire);
+}
+
+size_t PublishedEquation::version() const{
+	return current_version.load(std::memory_order_acquire);
+}
+
+
+
+PublishedEquation::Reader::Reader(const PublishedEquation& source) : source(&source){
+	current_version = source.version();
+	current = source.snapshot();
+}
+
+const CompiledEquation& PublishedEquation::Reader::get(){
+	size_t latest = source->version();
+	if(latest != current_version){
+		current = source->snapshot();
+		current_version = latest;
+	}
+	return *current;
+}
+
+const CompiledEquation* PublishedEquation::Reader::operator->(){
+	return &get();
+}
+
+SYMCALC_VALUE_TYPE PublishedEquation::Reader::eval(const std::vector<SYMCALC_VALUE_TYPE>& inputs){
+	return get().eval(inputs);
+}
+
+size_t PublishedEquation::Reader::version() const{
+	return current_version;
+}
+
+
+} // End of symcalc namespace
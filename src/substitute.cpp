@@ -0,0 +1,117 @@
+// Copyright 2024 Kyrylo Shyshko
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symcalc/symcalc.hpp"
+
+//
+// substitute.cpp:
+// Definitions for substitution of variables, used for partial evaluation and composition of expressions
+//
+
+namespace symcalc{
+
+
+// The numbers among the terms of a sum or the factors of a product are combined into one, which goes first,
+// so a + b + x with a and b given becomes a single offset and x
+static void fold_numeric_children(const EquationBase* eq, std::vector<EquationBase*>& children){
+	bool sum = eq->type == "sum";
+	SYMCALC_VALUE_TYPE value = sum ? 0 : 1;
+	size_t numbers = 0;
+	for(const EquationBase* child : children){
+		if(child->type == "val" || child->type == "const"){
+			SYMCALC_VALUE_TYPE child_value = dynamic_cast<const EquationValue*>(child)->value;
+			value = sum ? value + child_value : value * child_value;
+			numbers++;
+		}
+	}
+	if(numbers < 2){
+		return;
+	}
+	
+	std::vector<EquationBase*> folded {new EquationValue(value)};
+	for(EquationBase* child : children){
+		if(child->type == "val" || child->type == "const"){
+			delete_equation_base(child);
+		}else{
+			folded.push_back(child);
+		}
+	}
+	children.swap(folded);
+}
+
+
+static EquationBase* substitute_node(const EquationBase* eq, const std::map<SYMCALC_VAR_NAME_TYPE, const EquationBase*>& replacements, std::unordered_map<const EquationBase*, EquationBase*>& substituted){
+	std::unordered_map<const EquationBase*, EquationBase*>::iterator found = substituted.find(eq);
+	if(found != substituted.end()){
+		return copy(found->second);
+	}
+	
+	EquationBase* result;
+	size_t count = eq->_children_count();
+	
+	if(eq->type == "var"){
+		std::map<SYMCALC_VAR_NAME_TYPE, const EquationBase*>::const_iterator replacement = replacements.find(dynamic_cast<const Variable*>(eq)->name);
+		result = copy(replacement == replacements.end() ? eq : replacement->second);
+	}else if(count == 0){
+		result = copy(eq);
+	}else{
+		std::vector<EquationBase*> children;
+		children.reserve(count);
+		
+		bool changed = false;
+		bool numeric = true;
+		for(size_t i = 0; i < count; i++){
+			EquationBase* child = substitute_node(eq->_child(i), replacements, substituted);
+			changed = changed || child != eq->_child(i);
+			numeric = numeric && (child->type == "val" || child->type == "const");
+			children.push_back(child);
+		}
+		
+		if(!changed){
+			// Nothing was replaced below this node, share it instead of rebuilding
+			for(EquationBase* child : children){
+				delete_equation_base(child);
+			}
+			result = copy(eq);
+		}else{
+			if(!numeric && (eq->type == "sum" || eq->type == "mult")){
+				fold_numeric_children(eq, children);
+			}
+			result = eq->_rebuild(children);
+			if(numeric){
+				// All children became numbers, so the node is folded into its value
+				EquationBase* folded = new EquationValue(result->eval(SYMCALC_VAR_HASH_TYPE()));
+				delete_equation_base(result);
+				result = folded;
+			}
+		}
+	}
+	
+	// Shared nodes are substituted once, so substitution in a graph doesn't turn into a tree walk
+	substituted[eq] = copy(result);
+	return result;
+}
+
+
+EquationBase* substitute_equation_base(const EquationBase* eq, const std::map<SYMCALC_VAR_NAME_TYPE, const EquationBase*>& replacements){
+	std::unordered_map<const EquationBase*, EquationBase*> substituted;
+	EquationBase* result = substitute_node(eq, replacements, substituted);
+	for(const std::pair<const EquationBase* const, EquationBase*>& node : substituted){
+		delete_equation_base(node.second);
+	}
+	return result;
+}
+
+
+} // End of symcalc namespace
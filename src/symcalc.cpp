@@ -13,6 +13,8 @@
 // limitations under the License.
 
 #include "symcalc/symcalc.hpp"
+#include <algorithm>
+#include <iterator>
 
 //
 // symcalc.cpp:
@@ -22,20 +24,24 @@
 
 
 namespace symcalc{
-	
-bool SYMCALC_AUTO_SIMPLIFY = true;
-	
+
 EquationBase* to_equation(SYMCALC_VALUE_TYPE num){
 	return new EquationValue(num);
 }
 
 
 
-EquationBase::EquationBase(std::string el_type){
+// Shared by every node that doesn't depend on any variable
+static const std::shared_ptr<const std::vector<SYMCALC_VAR_NAME_TYPE>>& no_dependencies(){
+	static const std::shared_ptr<const std::vector<SYMCALC_VAR_NAME_TYPE>> empty = std::make_shared<const std::vector<SYMCALC_VAR_NAME_TYPE>>();
+	return empty;
+}
+
+EquationBase::EquationBase(std::string el_type) : hash_value(0), references(1), dependencies(no_dependencies()), tree_size(1){
 	this->type = el_type;
 }
 
-EquationBase::EquationBase(const EquationBase& lvalue){
+EquationBase::EquationBase(const EquationBase& lvalue) : hash_value(lvalue.hash_value), references(1), dependencies(lvalue.dependencies), tree_size(lvalue.tree_size){
 	type = lvalue.type;
 }
 
@@ -47,7 +53,66 @@ EquationBase::~EquationBase(){
 EquationBase* EquationBase::_simplify() const {return copy(this);};
 
 
-Variable::Variable(SYMCALC_VAR_NAME_TYPE name) : EquationBase("var"), name(name) {}
+bool EquationBase::_equals(const EquationBase* other) const{
+	size_t count = this->_children_count();
+	if(count != other->_children_count()){
+		return false;
+	}
+	for(size_t i = 0; i < count; i++){
+		if(!equal(this->_child(i), other->_child(i))){
+			return false;
+		}
+	}
+	return true;
+}
+
+EquationBase* EquationBase::_rebuild(std::vector<EquationBase*> children) const{
+	return copy(this);
+}
+
+void EquationBase::_cache_structure(){
+	size_t hash = std::hash<std::string>()(type);
+	size_t count = this->_children_count();
+	size_t nodes = 1;
+	for(size_t i = 0; i < count; i++){
+		hash = hash_combine(hash, this->_child(i)->hash_value);
+		// Saturates, since trees with shared subtrees can count more nodes than fit
+		nodes = std::min(nodes + this->_child(i)->tree_size, (size_t)-1 / 2);
+	}
+	this->hash_value = hash;
+	this->tree_size = nodes;
+	
+	// The set of a child is reused when it already contains the variables of the other children
+	std::shared_ptr<const std::vector<SYMCALC_VAR_NAME_TYPE>> deps = no_dependencies();
+	for(size_t i = 0; i < count; i++){
+		const std::shared_ptr<const std::vector<SYMCALC_VAR_NAME_TYPE>>& child_deps = this->_child(i)->dependencies;
+		if(child_deps == deps || child_deps->empty()){
+			continue;
+		}
+		if(deps->empty()){
+			deps = child_deps;
+			continue;
+		}
+		std::vector<SYMCALC_VAR_NAME_TYPE> merged;
+		merged.reserve(deps->size() + child_deps->size());
+		std::set_union(deps->begin(), deps->end(), child_deps->begin(), child_deps->end(), std::back_inserter(merged));
+		if(merged.size() == child_deps->size()){
+			deps = child_deps;
+		}else if(merged.size() != deps->size()){
+			deps = std::make_shared<const std::vector<SYMCALC_VAR_NAME_TYPE>>(std::move(merged));
+		}
+	}
+	this->dependencies = deps;
+}
+
+bool EquationBase::depends_on(const SYMCALC_VAR_NAME_TYPE& var) const{
+	return std::binary_search(dependencies->begin(), dependencies->end(), var);
+}
+
+
+Variable::Variable(SYMCALC_VAR_NAME_TYPE name) : EquationBase("var"), name(name) {
+	_cache_structure();
+}
 
 Variable::Variable(const Variable& lvalue) : EquationBase(lvalue){
 	name = lvalue.name;
@@ -66,8 +131,10 @@ std::string Variable::txt() const{
 	return name;
 }
 
-SYMCALC_VALUE_TYPE Variable::eval(SYMCALC_VAR_HASH_TYPE var_hash) const{
-	return var_hash[this->name];
+// Variables that aren't given are zero
+SYMCALC_VALUE_TYPE Variable::eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
+	SYMCALC_VAR_HASH_TYPE::const_iterator found = var_hash.find(this->name);
+	return found == var_hash.end() ? 0 : found->second;
 }
 
 
@@ -84,6 +151,16 @@ EquationBase* Variable::_simplify() const{
 	return copy(this);
 }
 
+bool Variable::_equals(const EquationBase* other) const{
+	const Variable* casted = dynamic_cast<const Variable*>(other);
+	return casted->name == this->name;
+}
+
+void Variable::_cache_structure(){
+	this->hash_value = hash_combine(std::hash<std::string>()(type), std::hash<SYMCALC_VAR_NAME_TYPE>()(name));
+	this->dependencies = std::make_shared<const std::vector<SYMCALC_VAR_NAME_TYPE>>(1, name);
+}
+
 EquationBase* Variable::_copy_equation_base() const{
 	const Variable* casted = dynamic_cast<const Variable*>(this);
 	return new Variable(*casted);
@@ -98,6 +175,7 @@ EquationValue::EquationValue(SYMCALC_VALUE_TYPE value) : EquationBase("val"), va
 	this->ready_txt = std::to_string(value);
 	this->ready_txt.erase(this->ready_txt.find_last_not_of('0') + 1, std::string::npos);
 	this->ready_txt.erase(this->ready_txt.find_last_not_of('.') + 1, std::string::npos);
+	_cache_structure();
 }
 
 EquationValue::EquationValue(const EquationValue& lvalue) : EquationBase(lvalue), value(lvalue.value), ready_txt(lvalue.ready_txt){
@@ -115,7 +193,7 @@ std::string EquationValue::txt() const{
 	return this->ready_txt;
 }
 
-SYMCALC_VALUE_TYPE EquationValue::eval(SYMCALC_VAR_HASH_TYPE var_hash) const{
+SYMCALC_VALUE_TYPE EquationValue::eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
 	return value;
 }
 
@@ -128,6 +206,15 @@ EquationBase* EquationValue::_simplify() const{
 	return copy(this);
 }
 
+bool EquationValue::_equals(const EquationBase* other) const{
+	const EquationValue* casted = dynamic_cast<const EquationValue*>(other);
+	return casted->value == this->value;
+}
+
+void EquationValue::_cache_structure(){
+	this->hash_value = hash_combine(std::hash<std::string>()(type), std::hash<SYMCALC_VALUE_TYPE>()(value));
+}
+
 
 EquationBase* EquationValue::_copy_equation_base() const{
 	const EquationValue* casted = dynamic_cast<const EquationValue*>(this);
@@ -143,6 +230,7 @@ void EquationValue::_delete_equation_base(){
 
 Constant::Constant(SYMCALC_VAR_NAME_TYPE name, SYMCALC_VALUE_TYPE value) : EquationValue(value), name(name) {
 	this->type = "const";
+	_cache_structure();
 }
 
 Constant::Constant(const Constant& lvalue) : EquationValue(lvalue){
@@ -153,6 +241,16 @@ std::string Constant::txt() const{
 	return this->name;
 }
 
+bool Constant::_equals(const EquationBase* other) const{
+	const Constant* casted = dynamic_cast<const Constant*>(other);
+	return casted->name == this->name && casted->value == this->value;
+}
+
+void Constant::_cache_structure(){
+	size_t hash = hash_combine(std::hash<std::string>()(type), std::hash<SYMCALC_VAR_NAME_TYPE>()(name));
+	this->hash_value = hash_combine(hash, std::hash<SYMCALC_VALUE_TYPE>()(value));
+}
+
 EquationBase* Constant::_copy_equation_base() const{
 	const Constant* casted = dynamic_cast<const Constant*>(this);
 	return new Constant(*casted);
@@ -175,8 +273,9 @@ Sum::Sum(std::vector<EquationBase*> inp_elements) : EquationBase("sum"){
 		if(el->type == "sum"){ // if the element is a sum - extract its elements into the current sum object
 			Sum* sum_element = dynamic_cast<Sum*>(el); // dynamic cast of EquationBase* to Sum* to get the .elements attribute
 			for(EquationBase* sum_el_part : sum_element->elements){
-				extracted_elements.push_back(sum_el_part);
+				extracted_elements.push_back(copy(sum_el_part));
 			};
+			delete_equation_base(el); // The elements are shared with the nested sum, so it can be released
 		}else{
 			extracted_elements.push_back(el);
 		}
@@ -184,18 +283,14 @@ Sum::Sum(std::vector<EquationBase*> inp_elements) : EquationBase("sum"){
 	
 	this->elements = extracted_elements;
 	
-	ready_txt = "(" + this->elements[0]->txt() + ")";
-	
-	for(size_t i = 1; i < this->elements.size(); i++){
-		ready_txt += " + (" + this->elements[i]->txt() + ")";
-	}
+	_cache_structure();
 }
 
 
 
 
 
-Sum::Sum(const Sum& lvalue) : EquationBase(lvalue), elements(), ready_txt(lvalue.ready_txt){
+Sum::Sum(const Sum& lvalue) : EquationBase(lvalue), elements(){
 	for(const EquationBase* lvalue_el : lvalue.elements){
 		elements.push_back(copy(lvalue_el));
 	}
@@ -231,10 +326,16 @@ std::vector<SYMCALC_VAR_NAME_TYPE> Sum::list_variables() const{
 
 
 std::string Sum::txt() const{
-	return ready_txt;
+	std::string txt = "(" + this->elements[0]->txt() + ")";
+	
+	for(size_t i = 1; i < this->elements.size(); i++){
+		txt += " + (" + this->elements[i]->txt() + ")";
+	}
+	
+	return txt;
 }
 
-SYMCALC_VALUE_TYPE Sum::eval(SYMCALC_VAR_HASH_TYPE var_hash) const{
+SYMCALC_VALUE_TYPE Sum::eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
 	SYMCALC_VALUE_TYPE result {0};
 	
 	for(EquationBase* el : this->elements){
@@ -249,10 +350,18 @@ EquationBase* Sum::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
 	std::vector<EquationBase*> derivs;
 	derivs.reserve(elements.size());
 	
-	for(EquationBase* el : elements){
-		derivs.push_back(el->_derivative(var));
+	// Terms that don't depend on the variable have a zero derivative and are left out
+	for(EquationBase* deriv : derivative_children(elements, var)){
+		if(deriv != nullptr){
+			derivs.push_back(deriv);
+		}
 	}
 	
+	if(derivs.empty()){
+		return new EquationValue(0);
+	}else if(derivs.size() == 1){
+		return derivs[0];
+	}
 	return new Sum(derivs);
 }
 
@@ -261,12 +370,13 @@ EquationBase* Sum::_simplify() const{
 	std::vector<EquationBase*> els;
 
 	
-	for(EquationBase* element : elements){
-		EquationBase* simplified = element->_simplify();
+	for(EquationBase* simplified : simplify_children(elements)){
 		if(simplified->type == "val"){
 			EquationValue* casted = dynamic_cast<EquationValue*>(simplified);
 			if(casted->value != 0){
 				els.push_back(simplified);
+			}else{
+				delete_equation_base(simplified);
 			}
 		}else{
 			els.push_back(simplified);
@@ -284,6 +394,18 @@ EquationBase* Sum::_simplify() const{
 	return new Sum(els);
 }
 
+size_t Sum::_children_count() const{
+	return elements.size();
+}
+
+EquationBase* Sum::_child(size_t i) const{
+	return elements[i];
+}
+
+EquationBase* Sum::_rebuild(std::vector<EquationBase*> children) const{
+	return new Sum(children);
+}
+
 EquationBase* Sum::_copy_equation_base() const{
 	const Sum* casted = dynamic_cast<const Sum*>(this);
 	return new Sum(*casted);
@@ -296,10 +418,10 @@ void Sum::_delete_equation_base(){
 
 
 Negate::Negate(EquationBase* eq) : EquationBase("neg"), eq(eq) {
-	this->ready_txt = "-(" + eq->txt() + ")";
+	_cache_structure();
 }
 
-Negate::Negate(const Negate& lvalue) : EquationBase(lvalue), eq(nullptr), ready_txt(lvalue.ready_txt){
+Negate::Negate(const Negate& lvalue) : EquationBase(lvalue), eq(nullptr){
 	const EquationBase* lvalue_eq = lvalue.eq;
 	eq = copy(lvalue_eq);
 }
@@ -314,28 +436,42 @@ std::vector<SYMCALC_VAR_NAME_TYPE> Negate::list_variables() const{
 
 
 std::string Negate::txt() const{
-	return this->ready_txt;
+	return "-(" + eq->txt() + ")";
 }
 
-SYMCALC_VALUE_TYPE Negate::eval(SYMCALC_VAR_HASH_TYPE var_hash) const{
+SYMCALC_VALUE_TYPE Negate::eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
 	return -eq->eval(var_hash);
 }
 
 EquationBase* Negate::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
-	return new Negate(eq->_derivative(var));
+	return new Negate(derivative_equation_base(eq, var));
 }
 
 
 EquationBase* Negate::_simplify() const{
-	EquationBase* simplified = eq->_simplify();
-	if(eq->type == "neg"){
+	EquationBase* simplified = simplify_equation_base(eq);
+	if(simplified->type == "neg"){
 		Negate* casted = dynamic_cast<Negate*>(simplified);
-		return casted->eq;
+		EquationBase* return_value = copy(casted->eq);
+		delete_equation_base(simplified);
+		return return_value;
 	}else{
 		return new Negate(simplified);
 	}
 }
 
+size_t Negate::_children_count() const{
+	return 1;
+}
+
+EquationBase* Negate::_child(size_t i) const{
+	return eq;
+}
+
+EquationBase* Negate::_rebuild(std::vector<EquationBase*> children) const{
+	return new Negate(children[0]);
+}
+
 EquationBase* Negate::_copy_equation_base() const{
 	const Negate* casted = dynamic_cast<const Negate*>(this);
 	return new Negate(*casted);
@@ -347,16 +483,17 @@ void Negate::_delete_equation_base(){
 
 
 
-Mult::Mult(std::vector<EquationBase*> inp_elements) : EquationBase("mult"){
+Mult::Mult(std::vector<EquationBase*> inp_elements, bool flatten) : EquationBase("mult"), grouped(!flatten){
 	std::vector<EquationBase*> extracted_elements;
 	
 	for(EquationBase* &el : inp_elements){	
 		
-		if(el->type == "mult"){ // if the element is a sum - extract its elements into the current sum object
+		if(flatten && el->type == "mult"){ // if the element is a sum - extract its elements into the current sum object
 			Mult* mult_element = dynamic_cast<Mult*>(el); // dynamic cast of EquationBase* to Sum* to get the .elements attribute
 			for(EquationBase* mult_el_part : mult_element->elements){
-				extracted_elements.push_back(mult_el_part);
+				extracted_elements.push_back(copy(mult_el_part));
 			};
+			delete_equation_base(el); // The elements are shared with the nested product, so it can be released
 		}else{
 			extracted_elements.push_back(el);
 		}
@@ -364,14 +501,10 @@ Mult::Mult(std::vector<EquationBase*> inp_elements) : EquationBase("mult"){
 	
 	this->elements = extracted_elements;
 	
-	ready_txt = "(" + this->elements[0]->txt() + ")";
-	
-	for(size_t i = 1; i < this->elements.size(); i++){
-		ready_txt += " * (" + this->elements[i]->txt() + ")";
-	}
+	_cache_structure();
 }
 
-Mult::Mult(const Mult& lvalue) : EquationBase(lvalue), elements(), ready_txt(lvalue.ready_txt){
+Mult::Mult(const Mult& lvalue) : EquationBase(lvalue), elements(), grouped(lvalue.grouped){
 	for(const EquationBase* lvalue_el : lvalue.elements){
 		elements.push_back(copy(lvalue_el));
 	}
@@ -402,10 +535,16 @@ std::vector<SYMCALC_VAR_NAME_TYPE> Mult::list_variables() const{
 
 
 std::string Mult::txt() const{
-	return ready_txt;
+	std::string txt = "(" + this->elements[0]->txt() + ")";
+	
+	for(size_t i = 1; i < this->elements.size(); i++){
+		txt += " * (" + this->elements[i]->txt() + ")";
+	}
+	
+	return txt;
 }
 
-SYMCALC_VALUE_TYPE Mult::eval(SYMCALC_VAR_HASH_TYPE var_hash) const{
+SYMCALC_VALUE_TYPE Mult::eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
 	SYMCALC_VALUE_TYPE result (1.0);
 	
 	for(EquationBase* el : this->elements){
@@ -417,6 +556,10 @@ SYMCALC_VALUE_TYPE Mult::eval(SYMCALC_VAR_HASH_TYPE var_hash) const{
 
 EquationBase* Mult::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
 	
+	if(elements.size() > SHARED_PRODUCT_RULE_SIZE){
+		return _shared_derivative(var);
+	}
+	
 	std::vector<EquationBase*> mults_to_sum;
 	mults_to_sum.reserve(elements.size());
 	
@@ -424,9 +567,16 @@ EquationBase* Mult::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
 	std::vector<EquationBase*> els_to_mult;
 	els_to_mult.reserve(elements.size());
 	
+	std::vector<EquationBase*> derivs = derivative_children(elements, var);
+	
 	for(size_t el_i = 0; el_i < elements.size(); el_i++){
 		
-		els_to_mult.push_back(elements[el_i]->_derivative(var));
+		// Product-rule terms of factors that don't depend on the variable are zero
+		if(derivs[el_i] == nullptr){
+			continue;
+		}
+		
+		els_to_mult.push_back(derivs[el_i]);
 		
 		for(size_t el_noderiv_i = 0; el_noderiv_i < elements.size(); el_noderiv_i++){
 			if(el_noderiv_i == el_i){
@@ -435,36 +585,73 @@ EquationBase* Mult::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
 			els_to_mult.push_back(copy(elements[el_noderiv_i]));
 		}
 		
-		mults_to_sum.push_back(new Mult(els_to_mult));
+		mults_to_sum.push_back(new Mult(els_to_mult, !grouped));
 		els_to_mult.clear();
 	}
 	
+	if(mults_to_sum.empty()){
+		return new EquationValue(0);
+	}else if(mults_to_sum.size() == 1){
+		return mults_to_sum[0];
+	}
 	return new Sum(mults_to_sum);
 }
 
 
+// Groups the factors [begin, end) into a balanced tree of two-factor products
+static EquationBase* group_factors(const std::vector<EquationBase*>& factors, size_t begin, size_t end){
+	if(end - begin == 1){
+		return copy(factors[begin]);
+	}
+	size_t middle = begin + (end - begin) / 2;
+	return new Mult({group_factors(factors, begin, middle), group_factors(factors, middle, end)}, false);
+}
+
+// Derivative of a product through a balanced grouping of its factors
+// d(L * R) = dL * R + L * dR, where L and R are the products of each half of the factors
+// Each group is shared by the terms that use it, so the result has O(n) nodes instead of the O(n^2) of the flat product rule
+EquationBase* Mult::_shared_derivative(SYMCALC_VAR_NAME_TYPE var) const{
+	EquationBase* grouped_product = group_factors(elements, 0, elements.size());
+	EquationBase* deriv = derivative_equation_base(grouped_product, var);
+	delete_equation_base(grouped_product);
+	return deriv;
+}
+
+
 
 EquationBase* Mult::_simplify() const{
 	
 	std::vector<EquationBase*> els;
 	
 	if(elements.size() == 1){
-		return elements[0]->_simplify();
+		return simplify_equation_base(elements[0]);
 	}
 	
 	SYMCALC_VALUE_TYPE coeff = 1.0; // Multiply all numerical values to a single coefficient
+	
+	// Factors are simplified one at a time unless they go to the pool, so the ones after a zero are skipped
+	bool forked = forks_children(elements);
+	std::vector<EquationBase*> simplified_elements;
+	if(forked){
+		simplified_elements = simplify_children(elements);
+	}
 
-	for(EquationBase* el : elements){
-		EquationBase* simplified = el->_simplify();
+	for(size_t i = 0; i < elements.size(); i++){
+		EquationBase* simplified = forked ? simplified_elements[i] : simplify_equation_base(elements[i]);
 		if(simplified->type == "val"){
 			EquationValue* casted = dynamic_cast<EquationValue*>(simplified);
 			if(casted->value == 0){ // If zero, stop loop and output zero, since anything * 0 is 0
 				for(EquationBase* el : els){
 					delete_equation_base(el);
 				}
+				delete_equation_base(simplified);
+				for(size_t j = i + 1; j < simplified_elements.size(); j++){
+					delete_equation_base(simplified_elements[j]);
+				}
 				return new EquationValue(0);
 			}else{
-				coeff *= casted->value;				
+				coeff *= casted->value;
+				delete_equation_base(simplified);
 			}
 		}else{
 			els.push_back(simplified);
@@ -479,9 +666,31 @@ EquationBase* Mult::_simplify() const{
 		return els[0];
 	}	
 
-	return new Mult(els);
+	return new Mult(els, !grouped);
+}
+
+
+size_t Mult::_children_count() const{
+	return elements.size();
 }
 
+EquationBase* Mult::_child(size_t i) const{
+	return elements[i];
+}
+
+EquationBase* Mult::_rebuild(std::vector<EquationBase*> children) const{
+	return new Mult(children, !grouped);
+}
+
+bool Mult::_equals(const EquationBase* other) const{
+	const Mult* casted = dynamic_cast<const Mult*>(other);
+	return casted->grouped == this->grouped && EquationBase::_equals(other);
+}
+
+void Mult::_cache_structure(){
+	EquationBase::_cache_structure();
+	this->hash_value = hash_combine(this->hash_value, std::hash<bool>()(grouped));
+}
 
 EquationBase* Mult::_copy_equation_base() const{
 	const Mult* casted = dynamic_cast<const Mult*>(this);
@@ -497,10 +706,10 @@ void Mult::_delete_equation_base(){
 
 
 Div::Div(EquationBase* dividend, EquationBase* divisor) : EquationBase("div"), dividend(dividend), divisor(divisor){
-	this->ready_txt = "(" + dividend->txt() + ") / (" + divisor->txt() + ")"; 
+	_cache_structure();
 }
 
-Div::Div(const Div& lvalue) : EquationBase(lvalue), ready_txt(lvalue.ready_txt){
+Div::Div(const Div& lvalue) : EquationBase(lvalue){
 	const EquationBase* lvalue_dividend = lvalue.dividend;
 	dividend = copy(lvalue_dividend);
 	
@@ -525,20 +734,26 @@ std::vector<SYMCALC_VAR_NAME_TYPE> Div::list_variables() const{
 }
 
 std::string Div::txt() const{
-	return this->ready_txt;
+	return "(" + dividend->txt() + ") / (" + divisor->txt() + ")";
 }
 
-SYMCALC_VALUE_TYPE Div::eval(SYMCALC_VAR_HASH_TYPE var_hash) const{
+SYMCALC_VALUE_TYPE Div::eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
 	return dividend->eval(var_hash) / divisor->eval(var_hash);
 }
 
 EquationBase* Div::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
 	
+	// Derivative of f(x) / C
+	// = f'(x) / C
+	if(!divisor->depends_on(var)){
+		return new Div(derivative_equation_base(dividend, var), copy(divisor));
+	}
+	
 	// Derivative of f(x) / g(x)
 	// = (f'(x) * g(x) - f(x) * g'(x)) / g(x)^2
 	
-	EquationBase* left_part = new Mult({dividend->_derivative(var), copy(divisor)}); // f'(x) * g(x)
-	EquationBase* right_part = new Mult({copy(dividend), divisor->_derivative(var)}); // f(x) * g'(x)
+	EquationBase* left_part = new Mult({derivative_equation_base(dividend, var), copy(divisor)}); // f'(x) * g(x)
+	EquationBase* right_part = new Mult({copy(dividend), derivative_equation_base(divisor, var)}); // f(x) * g'(x)
 	
 	EquationBase* top = new Sum({left_part, new Negate(right_part)}); // f'(x) * g(x) - f(x) * g'(x)
 	
@@ -551,13 +766,25 @@ EquationBase* Div::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
 
 EquationBase* Div::_simplify() const{
 	
-	EquationBase* dividend_s = dividend->_simplify();
-	EquationBase* divisor_s = divisor->_simplify();
+	EquationBase* dividend_s = simplify_equation_base(dividend);
+	EquationBase* divisor_s = simplify_equation_base(divisor);
 	
 	return new Div(dividend_s, divisor_s);
 }
 
 
+size_t Div::_children_count() const{
+	return 2;
+}
+
+EquationBase* Div::_child(size_t i) const{
+	return i == 0 ? dividend : divisor;
+}
+
+EquationBase* Div::_rebuild(std::vector<EquationBase*> children) const{
+	return new Div(children[0], children[1]);
+}
+
 EquationBase* Div::_copy_equation_base() const{
 	const Div* casted = dynamic_cast<const Div*>(this);
 	return new Div(*casted);
@@ -572,10 +799,10 @@ void Div::_delete_equation_base(){
 
 
 Power::Power(EquationBase* base, EquationBase* power) : EquationBase("pow"), base(base), power(power){
-	this->ready_txt = "(" + base->txt() + ") ^ (" + power->txt() + ")";
+	_cache_structure();
 }
 
-Power::Power(const Power& lvalue) : EquationBase(lvalue), ready_txt(lvalue.ready_txt){
+Power::Power(const Power& lvalue) : EquationBase(lvalue){
 	const EquationBase* lvalue_base = lvalue.base;
 	this->base = copy(lvalue_base);
 	
@@ -602,10 +829,10 @@ std::vector<SYMCALC_VAR_NAME_TYPE> Power::list_variables() const{
 
 
 std::string Power::txt() const{
-	return this->ready_txt;
+	return "(" + base->txt() + ") ^ (" + power->txt() + ")";
 }
 
-SYMCALC_VALUE_TYPE Power::eval(SYMCALC_VAR_HASH_TYPE var_hash) const{
+SYMCALC_VALUE_TYPE Power::eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
 	return std::pow(base->eval(var_hash), power->eval(var_hash));
 }
 
@@ -622,18 +849,27 @@ EquationBase* Power::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
 		EquationBase* power_copy = copy(power); // C
 		EquationBase* base_copy = copy(base); // g
 		EquationBase* new_eq_value = new EquationValue(power_eq->value - 1); // C - 1
-		EquationBase* base_deriv = base->_derivative(var); // dg/dx
+		EquationBase* base_deriv = derivative_equation_base(base, var); // dg/dx
 		EquationBase* power_to_mult = new Power(base_copy, new_eq_value); // g ^ C - 1
 		
 		EquationBase* final_mult = new Mult({power_copy, power_to_mult, base_deriv}); // C * g^(C - 1) * dg/dx
 		return final_mult;
+	}else if(!power->depends_on(var)){
+		// Same as above when the power doesn't depend on the variable
+		// df/dx = h * g^(h - 1) * dg/dx
+		EquationBase* new_power = new Sum({copy(power), new EquationValue(-1)}); // h - 1
+		EquationBase* power_to_mult = new Power(copy(base), new_power); // g ^ (h - 1)
+		return new Mult({copy(power), power_to_mult, derivative_equation_base(base, var)});
+	}else if(!base->depends_on(var)){
+		// derivative of C ^ g(x) = C^g(x) * ln(C) * g'(x)
+		return new Mult({copy(this), new Ln(copy(base)), derivative_equation_base(power, var)});
 	}else{
 		// derivative of f(x) ^ g(x) = f(x)^g(x) * (g'(x) * ln(f(x)) + f'(x) * g(x) / f(x))
 		EquationBase* mult_l_part = new Power(copy(base), copy(power));
 		
-		EquationBase* sum_l_part = new Mult({power->_derivative(var), new Ln(copy(base))});
+		EquationBase* sum_l_part = new Mult({derivative_equation_base(power, var), new Ln(copy(base))});
 		
-		EquationBase* sum_r_part_mult = new Mult({base->_derivative(var), copy(power)});
+		EquationBase* sum_r_part_mult = new Mult({derivative_equation_base(base, var), copy(power)});
 		EquationBase* sum_r_part = new Div(sum_r_part_mult, copy(base));
 		
 		EquationBase* mult_r_part = new Sum({sum_l_part, sum_r_part});
@@ -646,23 +882,27 @@ EquationBase* Power::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
 
 EquationBase* Power::_simplify() const{
 
-	EquationBase* base_s = base->_simplify();
-	EquationBase* power_s = power->_simplify();
+	EquationBase* base_s = simplify_equation_base(base);
+	EquationBase* power_s = simplify_equation_base(power);
 
 	if(base_s->type == "val"){
 		EquationValue* casted = dynamic_cast<EquationValue*>(base_s);
-		if(casted->value == 0){
-			return new EquationValue(0);
-		}else if(casted->value == 1){
-			return new EquationValue(1);
+		if(casted->value == 0 || casted->value == 1){
+			EquationBase* return_value = new EquationValue(casted->value);
+			delete_equation_base(base_s);
+			delete_equation_base(power_s);
+			return return_value;
 		}
 	}
 	
 	if(power_s->type=="val"){
 		EquationValue* casted = dynamic_cast<EquationValue*>(power_s);
 		if(casted->value == 0){
+			delete_equation_base(base_s);
+			delete_equation_base(power_s);
 			return new EquationValue(1);
 		}else if(casted->value == 1){
+			delete_equation_base(power_s);
 			return base_s;
 		}
 	}
@@ -671,6 +911,18 @@ EquationBase* Power::_simplify() const{
 	
 }
 
+size_t Power::_children_count() const{
+	return 2;
+}
+
+EquationBase* Power::_child(size_t i) const{
+	return i == 0 ? base : power;
+}
+
+EquationBase* Power::_rebuild(std::vector<EquationBase*> children) const{
+	return new Power(children[0], children[1]);
+}
+
 EquationBase* Power::_copy_equation_base() const{
 	const Power* casted = dynamic_cast<const Power*>(this);
 	return new Power(*casted);
@@ -684,10 +936,10 @@ void Power::_delete_equation_base(){
 
 
 Log::Log(EquationBase* eq, EquationBase* base) : EquationBase("log"), eq(eq), base(base){
-	this->ready_txt = "log_(" + base->txt() + ")(" + eq->txt() + ")";
+	_cache_structure();
 }
 
-Log::Log(const Log& lvalue) : EquationBase(lvalue), ready_txt(lvalue.ready_txt){
+Log::Log(const Log& lvalue) : EquationBase(lvalue){
 	const EquationBase* lvalue_eq = lvalue.eq;
 	const EquationBase* lvalue_base = lvalue.base;
 	this->eq = copy(lvalue_eq);
@@ -711,26 +963,45 @@ std::vector<SYMCALC_VAR_NAME_TYPE> Log::list_variables() const{
 
 
 std::string Log::txt() const{
-	return this->ready_txt;
+	return "log_(" + base->txt() + ")(" + eq->txt() + ")";
 }
 
-SYMCALC_VALUE_TYPE Log::eval(SYMCALC_VAR_HASH_TYPE var_hash) const{
+SYMCALC_VALUE_TYPE Log::eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
 	return std::log(eq->eval(var_hash)) / std::log(base->eval(var_hash));
 }
 
 EquationBase* Log::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
-	EquationBase* div = new Div(eq->_derivative(var), copy(eq));
-	EquationBase* natural_log = new Ln(copy(this->base));
-	return new Mult({div, natural_log});
+	// log_b(f) = ln(f) / ln(b)
+	// derivative = f' / (f * ln(b)) - ln(f) * b' / (b * ln(b)^2)
+	EquationBase* eq_part = new Div(derivative_equation_base(eq, var), new Mult({copy(eq), new Ln(copy(base))})); // f' / (f * ln(b))
+	if(!base->depends_on(var)){
+		return eq_part;
+	}
+	
+	EquationBase* base_top = new Mult({new Ln(copy(eq)), derivative_equation_base(base, var)}); // ln(f) * b'
+	EquationBase* base_bottom = new Mult({copy(base), new Power(new Ln(copy(base)), new EquationValue(2))}); // b * ln(b)^2
+	return new Sum({eq_part, new Negate(new Div(base_top, base_bottom))});
 }
 
 
 EquationBase* Log::_simplify() const{
-	EquationBase* simplified_eq = eq->_simplify();
-	EquationBase* simplified_base = base->_simplify();
+	EquationBase* simplified_eq = simplify_equation_base(eq);
+	EquationBase* simplified_base = simplify_equation_base(base);
 	return new Log(simplified_eq, simplified_base);
 }
 
+size_t Log::_children_count() const{
+	return 2;
+}
+
+EquationBase* Log::_child(size_t i) const{
+	return i == 0 ? eq : base;
+}
+
+EquationBase* Log::_rebuild(std::vector<EquationBase*> children) const{
+	return new Log(children[0], children[1]);
+}
+
 EquationBase* Log::_copy_equation_base() const{
 	const Log* casted = dynamic_cast<const Log*>(this);
 	return new Log(*casted);
@@ -747,10 +1018,10 @@ void Log::_delete_equation_base(){
 
 
 Ln::Ln(EquationBase* eq) : EquationBase("ln"), eq(eq){
-	this->ready_txt = "ln(" + eq->txt() + ")";
+	_cache_structure();
 }
 
-Ln::Ln(const Ln& lvalue) : EquationBase(lvalue), ready_txt(lvalue.ready_txt){
+Ln::Ln(const Ln& lvalue) : EquationBase(lvalue){
 	const EquationBase* lvalue_eq = lvalue.eq;
 	eq = copy(lvalue_eq);
 }
@@ -765,20 +1036,20 @@ std::vector<SYMCALC_VAR_NAME_TYPE> Ln::list_variables() const{
 
 
 std::string Ln::txt() const{
-	return this->ready_txt;
+	return "ln(" + eq->txt() + ")";
 }
 
-SYMCALC_VALUE_TYPE Ln::eval(SYMCALC_VAR_HASH_TYPE var_hash) const{
+SYMCALC_VALUE_TYPE Ln::eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
 	return std::log(eq->eval(var_hash));
 }
 
 EquationBase* Ln::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
-	return new Div(eq->_derivative(var), copy(eq));
+	return new Div(derivative_equation_base(eq, var), copy(eq));
 }
 
 
 EquationBase* Ln::_simplify() const{
-	EquationBase* simplified = eq->_simplify();
+	EquationBase* simplified = simplify_equation_base(eq);
 	if(simplified->type == "exp"){
 		Exp* casted = dynamic_cast<Exp*>(simplified);
 		EquationBase* return_value = copy(casted->eq);
@@ -794,6 +1065,18 @@ EquationBase* Ln::_simplify() const{
 	return new Ln(simplified);
 }
 
+size_t Ln::_children_count() const{
+	return 1;
+}
+
+EquationBase* Ln::_child(size_t i) const{
+	return eq;
+}
+
+EquationBase* Ln::_rebuild(std::vector<EquationBase*> children) const{
+	return new Ln(children[0]);
+}
+
 EquationBase* Ln::_copy_equation_base() const{
 	const Ln* casted = dynamic_cast<const Ln*>(this);
 	return new Ln(*casted);
@@ -812,10 +1095,10 @@ void Ln::_delete_equation_base(){
 
 
 Exp::Exp(EquationBase* eq) : EquationBase("exp"), eq(eq) {
-
+	_cache_structure();
 }
 
-Exp::Exp(const Exp& lvalue) : EquationBase("exp"){
+Exp::Exp(const Exp& lvalue) : EquationBase(lvalue){
 	eq = copy(lvalue.eq);
 }
 
@@ -831,12 +1114,12 @@ std::string Exp::txt() const{
 }
 
 
-SYMCALC_VALUE_TYPE Exp::eval(SYMCALC_VAR_HASH_TYPE var_hash) const{
+SYMCALC_VALUE_TYPE Exp::eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
 	return std::exp(eq->eval(var_hash));
 }
 
 EquationBase* Exp::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
-	return new Mult({copy(this), eq->_derivative(var)});
+	return new Mult({copy(this), derivative_equation_base(eq, var)});
 }
 
 
@@ -846,15 +1129,29 @@ std::vector<SYMCALC_VAR_NAME_TYPE> Exp::list_variables() const{
 
 
 EquationBase* Exp::_simplify() const{
-	EquationBase* simplified = eq->_simplify();
+	EquationBase* simplified = simplify_equation_base(eq);
 	if(simplified->type == "ln"){
 		Ln* casted = dynamic_cast<Ln*>(simplified);
-		return casted->eq;
+		EquationBase* return_value = copy(casted->eq);
+		delete_equation_base(simplified);
+		return return_value;
 	}else{
 		return new Exp(simplified);
 	}
 }
 
+size_t Exp::_children_count() const{
+	return 1;
+}
+
+EquationBase* Exp::_child(size_t i) const{
+	return eq;
+}
+
+EquationBase* Exp::_rebuild(std::vector<EquationBase*> children) const{
+	return new Exp(children[0]);
+}
+
 EquationBase* Exp::_copy_equation_base() const{
 	const Exp* casted = dynamic_cast<const Exp*>(this);
 	return new Exp(*casted);
@@ -870,7 +1167,9 @@ void Exp::_delete_equation_base(){
 
 
 
-Abs::Abs(EquationBase* insides) : EquationBase("abs"), insides(insides) {} // Normal constructor
+Abs::Abs(EquationBase* insides) : EquationBase("abs"), insides(insides) { // Normal constructor
+	_cache_structure();
+}
 Abs::Abs(const Abs& lvalue) : EquationBase(lvalue){
 	// Use the copy function to copy the insides of the lvalue Abs object
 	this->insides = copy(lvalue.insides);
@@ -883,6 +1182,19 @@ Abs::~Abs(){
 }
 
 
+// Children access
+size_t Abs::_children_count() const{
+	return 1;
+}
+
+EquationBase* Abs::_child(size_t i) const{
+	return insides;
+}
+
+EquationBase* Abs::_rebuild(std::vector<EquationBase*> children) const{
+	return new Abs(children[0]);
+}
+
 // Dynamic cast copy function
 EquationBase* Abs::_copy_equation_base() const{
 	const Abs* casted = dynamic_cast<const Abs*>(this);
@@ -902,7 +1214,7 @@ std::string Abs::txt() const{
 }
 
 // Eval function
-SYMCALC_VALUE_TYPE Abs::eval(SYMCALC_VAR_HASH_TYPE var_hash) const{
+SYMCALC_VALUE_TYPE Abs::eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
 	SYMCALC_VALUE_TYPE insides_eval = insides->eval(var_hash);
 	if(insides_eval < 0){
 		return -insides_eval;
@@ -922,7 +1234,7 @@ std::vector<SYMCALC_VAR_NAME_TYPE> Abs::list_variables() const{
 // If f(x) = x, then
 // |x|' = (x / |x|) * (x)' = (x / |x|) * 1 = x / |x|
 EquationBase* Abs::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
-	EquationBase* insides_derivative = insides->_derivative(var); // f'(x)
+	EquationBase* insides_derivative = derivative_equation_base(insides, var); // f'(x)
 	EquationBase* insides_copy_1 = copy(insides); // f(x)
 	EquationBase* insides_copy_2 = copy(insides); // f(x)
 	EquationBase* abs_insides = new Abs(insides_copy_2); // |f(x)|
@@ -934,7 +1246,7 @@ EquationBase* Abs::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
 
 // Simplify function
 EquationBase* Abs::_simplify() const{
-	EquationBase* simplified_insides = insides->_simplify();
+	EquationBase* simplified_insides = simplify_equation_base(insides);
 	if(simplified_insides->type == "abs"){
 		return simplified_insides; // Absolute function twice is the same as once, ||x|| = |x| 
 	}else if(simplified_insides->type == "pow"){
@@ -960,7 +1272,9 @@ EquationBase* Abs::_simplify() const{
 
 
 
-Sin::Sin(EquationBase* eq) : EquationBase("sin"), eq(eq) {};
+Sin::Sin(EquationBase* eq) : EquationBase("sin"), eq(eq) {
+	_cache_structure();
+};
 
 Sin::Sin(const Sin& lvalue) : EquationBase(lvalue){
 	eq = copy(lvalue.eq);
@@ -980,7 +1294,7 @@ std::vector<SYMCALC_VAR_NAME_TYPE> Sin::list_variables() const{
 }
 
 
-SYMCALC_VALUE_TYPE Sin::eval(SYMCALC_VAR_HASH_TYPE var_hash) const{
+SYMCALC_VALUE_TYPE Sin::eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
 	return std::sin(eq->eval(var_hash));
 }
 
@@ -991,10 +1305,22 @@ EquationBase* Sin::_simplify() const{
 
 EquationBase* Sin::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
 	EquationBase* cos_func = new Cos(copy(eq));
-	EquationBase* eq_deriv = eq->_derivative(var);
+	EquationBase* eq_deriv = derivative_equation_base(eq, var);
 	return new Mult({cos_func, eq_deriv});
 }
 
+size_t Sin::_children_count() const{
+	return 1;
+}
+
+EquationBase* Sin::_child(size_t i) const{
+	return eq;
+}
+
+EquationBase* Sin::_rebuild(std::vector<EquationBase*> children) const{
+	return new Sin(children[0]);
+}
+
 EquationBase* Sin::_copy_equation_base() const{
 	const Sin* casted = dynamic_cast<const Sin*>(this);
 	return new Sin(*casted);
@@ -1013,7 +1339,9 @@ void Sin::_delete_equation_base(){
 
 
 
-Cos::Cos(EquationBase* eq) : EquationBase("cos"), eq(eq) {};
+Cos::Cos(EquationBase* eq) : EquationBase("cos"), eq(eq) {
+	_cache_structure();
+};
 
 Cos::Cos(const Cos& lvalue) : EquationBase(lvalue){
 	eq = copy(lvalue.eq);
@@ -1033,7 +1361,7 @@ std::vector<SYMCALC_VAR_NAME_TYPE> Cos::list_variables() const{
 }
 
 
-SYMCALC_VALUE_TYPE Cos::eval(SYMCALC_VAR_HASH_TYPE var_hash) const{
+SYMCALC_VALUE_TYPE Cos::eval(const SYMCALC_VAR_HASH_TYPE& var_hash) const{
 	return std::cos(eq->eval(var_hash));
 }
 
@@ -1044,10 +1372,22 @@ EquationBase* Cos::_simplify() const{
 
 EquationBase* Cos::_derivative(SYMCALC_VAR_NAME_TYPE var) const{
 	EquationBase* minus_sin_func = new Negate(new Sin(copy(eq)));
-	EquationBase* eq_deriv = eq->_derivative(var);
+	EquationBase* eq_deriv = derivative_equation_base(eq, var);
 	return new Mult({minus_sin_func, eq_deriv});
 }
 
+size_t Cos::_children_count() const{
+	return 1;
+}
+
+EquationBase* Cos::_child(size_t i) const{
+	return eq;
+}
+
+EquationBase* Cos::_rebuild(std::vector<EquationBase*> children) const{
+	return new Cos(children[0]);
+}
+
 EquationBase* Cos::_copy_equation_base() const{
 	const Cos* casted = dynamic_cast<const Cos*>(this);
 	return new Cos(*casted);
@@ -1067,8 +1407,8 @@ void Cos::_delete_equation_base(){
 // Constants
 
 namespace Constants{
-	Equation Pi ("pi", M_PI);
-	Equation E ("e", std::exp(1.0));
+	const Equation Pi ("pi", M_PI);
+	const Equation E ("e", std::exp(1.0));
 }
 
 
@@ -0,0 +1,232 @@
+// Copyright 2024 Kyrylo Shyshko
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//    http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symcalc/symcalc.hpp"
+#include <stdexcept>
+
+//
+// taylor.cpp:
+// Taylor-mode evaluation, truncated series arithmetic in one variable
+// Every node combines the series of its children with a recurrence on the coefficients,
+// so all derivatives up to order k cost O(k^2) per node instead of k nested derivative trees
+//
+
+namespace symcalc{
+
+
+static TaylorSeries constant_series(SYMCALC_VALUE_TYPE value, size_t order){
+	TaylorSeries series (order + 1, 0);
+	series[0] = value;
+	return series;
+}
+
+static bool is_constant(const TaylorSeries& series){
+	for(size_t k = 1; k < series.size(); k++){
+		if(series[k] != 0) return false;
+	}
+	return true;
+}
+
+// Cauchy product, truncated to the order of the series
+static TaylorSeries multiply(const TaylorSeries& f, const TaylorSeries& g){
+	TaylorSeries result (f.size(), 0);
+	for(size_t k = 0; k < f.size(); k++){
+		for(size_t i = 0; i <= k; i++){
+			result[k] += f[i] * g[k - i];
+		}
+	}
+	return result;
+}
+
+// q = f / g, from f = q * g: q_k = (f_k - sum of g_i * q_(k-i) for i >= 1) / g_0
+static TaylorSeries divide(const TaylorSeries& f, const TaylorSeries& g){
+	TaylorSeries result (f.size(), 0);
+	for(size_t k = 0; k < f.size(); k++){
+		SYMCALC_VALUE_TYPE sum = f[k];
+		for(size_t i = 1; i <= k; i++){
+			sum -= g[i] * result[k - i];
+		}
+		result[k] = sum / g[0];
+	}
+	return result;
+}
+
+// e = exp(f), from e' = f' * e: e_k = sum of j * f_j * e_(k-j) / k
+static TaylorSeries series_exp(const TaylorSeries& f){
+	TaylorSeries result (f.size(), 0);
+	result[0] = std::exp(f[0]);
+	for(size_t k = 1; k < f.size(); k++){
+		for(size_t j = 1; j <= k; j++){
+			result[k] += j * f[j] * result[k - j];
+		}
+		result[k] /= k;
+	}
+	return result;
+}
+
+// l = ln(f), from f * l' = f': l_k = (f_k - sum of j * l_j * f_(k-j) / k for j < k) / f_0
+static TaylorSeries series_ln(const TaylorSeries& f){
+	TaylorSeries result (f.size(), 0);
+	result[0] = std::log(f[0]);
+	for(size_t k = 1; k < f.size(); k++){
+		SYMCALC_VALUE_TYPE sum = 0;
+		for(size_t j = 1; j < k; j++){
+			sum += j * result[j] * f[k - j];
+		}
+		result[k] = (f[k] - sum / k) / f[0];
+	}
+	return result;
+}
+
+// s = sin(f) and c = cos(f) together, from s' = c * f' and c' = -s * f'
+static void series_sin_cos(const TaylorSeries& f, TaylorSeries& sin_series, TaylorSeries& cos_series){
+	sin_series.assign(f.size(), 0);
+	cos_series.assign(f.size(), 0);
+	sin_series[0] = std::sin(f[0]);
+	cos_series[0] = std::cos(f[0]);
+	for(size_t k = 1; k < f.size(); k++){
+		for(size_t j = 1; j <= k; j++){
+			sin_series[k] += j * f[j] * cos_series[k - j];
+			cos_series[k] -= j * f[j] * sin_series[k - j];
+		}
+		sin_series[k] /= k;
+		cos_series[k] /= k;
+	}
+}
+
+// p = g^c for a constant c, from g * p' = c * p * g': p_k = sum of ((c + 1) * j - k) * g_j * p_(k-j) / (k * g_0)
+// A zero base only works with a power that is a natural number, which is computed by repeated squaring
+static TaylorSeries series_constant_power(const TaylorSeries& g, SYMCALC_VALUE_TYPE power){
+	if(g[0] == 0 && power >= 0 && power == std::floor(power)){
+		TaylorSeries result = constant_series(1, g.size() - 1);
+		TaylorSeries square = g;
+		for(unsigned long long n = (unsigned long long)power; n > 0; n >>= 1){
+			if(n & 1) result = multiply(result, square);
+			if(n > 1) square = multiply(square, square);
+		}
+		return result;
+	}
+
+	TaylorSeries result (g.size(), 0);
+	result[0] = std::pow(g[0], power);
+	for(size_t k = 1; k < g.size(); k++){
+		for(size_t j = 1; j <= k; j++){
+			result[k] += ((power + 1) * j - (SYMCALC_VALUE_TYPE)k) * g[j] * result[k - j];
+		}
+		result[k] /= k * g[0];
+	}
+	return result;
+}
+
+
+
+TaylorSeries EquationBase::eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const{
+	throw std::runtime_error("Taylor-mode evaluation isn't supported for expressions of type " + type);
+}
+
+
+// Variables that aren't given are zero, like in eval()
+TaylorSeries Variable::eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const{
+	SYMCALC_VAR_HASH_TYPE::const_iterator found = var_hash.find(name);
+	TaylorSeries series = constant_series(found == var_hash.end() ? 0 : found->second, order);
+	if(name == var && order > 0){
+		series[1] = 1;
+	}
+	return series;
+}
+
+TaylorSeries EquationValue::eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const{
+	return constant_series(value, order);
+}
+
+
+TaylorSeries Sum::eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const{
+	TaylorSeries result (order + 1, 0);
+	for(const EquationBase* el : elements){
+		TaylorSeries el_series = el->eval_taylor(var_hash, var, order);
+		for(size_t k = 0; k <= order; k++){
+			result[k] += el_series[k];
+		}
+	}
+	return result;
+}
+
+TaylorSeries Negate::eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const{
+	TaylorSeries result = eq->eval_taylor(var_hash, var, order);
+	for(SYMCALC_VALUE_TYPE& coefficient : result){
+		coefficient = -coefficient;
+	}
+	return result;
+}
+
+TaylorSeries Mult::eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const{
+	TaylorSeries result = constant_series(1, order);
+	for(const EquationBase* el : elements){
+		result = multiply(result, el->eval_taylor(var_hash, var, order));
+	}
+	return result;
+}
+
+TaylorSeries Div::eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const{
+	return divide(dividend->eval_taylor(var_hash, var, order), divisor->eval_taylor(var_hash, var, order));
+}
+
+// Same cases as Power::_derivative(), so a negative base with a constant power still has a series
+TaylorSeries Power::eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const{
+	TaylorSeries base_series = base->eval_taylor(var_hash, var, order);
+	TaylorSeries power_series = power->eval_taylor(var_hash, var, order);
+	if(is_constant(power_series)){
+		return series_constant_power(base_series, power_series[0]);
+	}
+	// g ^ h = exp(h * ln(g))
+	return series_exp(multiply(power_series, series_ln(base_series)));
+}
+
+TaylorSeries Log::eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const{
+	return divide(series_ln(eq->eval_taylor(var_hash, var, order)), series_ln(base->eval_taylor(var_hash, var, order)));
+}
+
+TaylorSeries Ln::eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const{
+	return series_ln(eq->eval_taylor(var_hash, var, order));
+}
+
+TaylorSeries Exp::eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const{
+	return series_exp(eq->eval_taylor(var_hash, var, order));
+}
+
+// |f| = f * sign(f), which isn't defined at zero like the symbolic derivative
+TaylorSeries Abs::eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const{
+	TaylorSeries result = insides->eval_taylor(var_hash, var, order);
+	SYMCALC_VALUE_TYPE sign = result[0] / std::abs(result[0]);
+	result[0] = std::abs(result[0]);
+	for(size_t k = 1; k <= order; k++){
+		result[k] *= sign;
+	}
+	return result;
+}
+
+TaylorSeries Sin::eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const{
+	TaylorSeries sin_series, cos_series;
+	series_sin_cos(eq->eval_taylor(var_hash, var, order), sin_series, cos_series);
+	return sin_series;
+}
+
+TaylorSeries Cos::eval_taylor(const SYMCALC_VAR_HASH_TYPE& var_hash, const SYMCALC_VAR_NAME_TYPE& var, size_t order) const{
+	TaylorSeries sin_series, cos_series;
+	series_sin_cos(eq->eval_taylor(var_hash, var, order), sin_series, cos_series);
+	return cos_series;
+}
+
+
+} // End of symcalc namespace